@@ -6,8 +6,34 @@
 #include <string.h>
 #include <limits.h>
 #include <float.h>
+#include <sys/stat.h>
 #include "tigr.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define HAVE_SSE2
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define HAVE_AVX2
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#ifdef __GNUC__
+  #define INLINE static inline __attribute__((always_inline))
+#else
+  #define INLINE static inline
+#endif
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <sys/mman.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
 #define PI        3.14159
 #define WIDTH     320
 #define HEIGHT    240
@@ -49,6 +75,71 @@ static int readline(char **buf, size_t *buflen, FILE *f) {
   return ch == EOF ? -1 : 0;
 }
 
+// read-only memory mapping of a whole file
+
+typedef struct {
+  char *p;
+  size_t len;
+#ifdef _WIN32
+  HANDLE file, mapping;
+#endif
+} mfile;
+
+// with cow set the pages are writable, but changes are never written back
+mfile *mfile_open(const char *path, int cow) {
+  mfile *m = calloc(1, sizeof(mfile));
+#ifdef _WIN32
+  m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m->file == INVALID_HANDLE_VALUE) { free(m); return NULL; }
+  LARGE_INTEGER size;
+  GetFileSizeEx(m->file, &size);
+  m->len = size.QuadPart;
+  if (m->len > 0) {
+    m->mapping = CreateFileMappingA(m->file, NULL, cow ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    m->p = m->mapping ? MapViewOfFile(m->mapping, cow ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (m->p == NULL) error("failed to map file: %s", path);
+  }
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { free(m); return NULL; }
+  struct stat st;
+  fstat(fd, &st);
+  m->len = st.st_size;
+  if (m->len > 0) {
+    m->p = mmap(NULL, m->len, PROT_READ | (cow ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+    if (m->p == MAP_FAILED) error("failed to map file: %s", path);
+    if (!cow) madvise(m->p, m->len, MADV_SEQUENTIAL);
+  }
+  close(fd);
+#endif
+  return m;
+}
+
+void mfile_close(mfile *m) {
+#ifdef _WIN32
+  if (m->p) UnmapViewOfFile(m->p);
+  if (m->mapping) CloseHandle(m->mapping);
+  CloseHandle(m->file);
+#else
+  if (m->p) munmap(m->p, m->len);
+#endif
+  free(m);
+}
+
+// seconds since an arbitrary point, for timing
+double now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, t;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&t);
+  return (double)t.QuadPart / freq.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
 char *relpath(const char *name, const char *path) {
 #ifdef _WIN32
   #define DIR_SEP '\\'
@@ -77,6 +168,71 @@ char *trim(char *s) {
   return s;
 }
 
+// scanners working on [s, e) ranges that are not NUL-terminated.
+// each returns the position after the parsed token, or NULL if none.
+
+const char *scan_space(const char *s, const char *e) {
+  while (s < e && (*s == ' ' || *s == '\t' || *s == '\r')) s++;
+  return s;
+}
+
+const char *scan_int(const char *s, const char *e, int *out) {
+  s = scan_space(s, e);
+  int neg = 0;
+  if (s < e && (*s == '-' || *s == '+')) neg = *s++ == '-';
+  if (s == e || (unsigned)(*s - '0') > 9) return NULL;
+  int n = 0;
+  while (s < e && (unsigned)(*s - '0') <= 9) n = n*10 + (*s++ - '0');
+  *out = neg ? -n : n;
+  return s;
+}
+
+const char *scan_float(const char *s, const char *e, float *out) {
+  static const float pow10[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+  };
+  s = scan_space(s, e);
+  const char *start = s;
+  int neg = 0;
+  if (s < e && (*s == '-' || *s == '+')) neg = *s++ == '-';
+
+  unsigned long long mant = 0;
+  int digits = 0, exp10 = 0, any = 0;
+  for (; s < e && (unsigned)(*s - '0') <= 9; s++, any = 1) {
+    if (digits < 19) { mant = mant*10 + (*s - '0'); if (mant) digits++; }
+    else exp10++;
+  }
+  if (s < e && *s == '.') {
+    for (s++; s < e && (unsigned)(*s - '0') <= 9; s++, any = 1) {
+      if (digits < 19) { mant = mant*10 + (*s - '0'); if (mant) digits++; exp10--; }
+    }
+  }
+  if (any && s < e && (*s == 'e' || *s == 'E')) {
+    int x;
+    const char *t = s+1;
+    if (t < e && *t != ' ' && *t != '\t' && (t = scan_int(t, e, &x)) != NULL) { exp10 += x; s = t; }
+  }
+
+  // when both the mantissa and the power of ten are exact floats, a single
+  // float operation rounds once, just like strtof. anything else (longer
+  // mantissas, larger exponents, hex, inf/nan) goes through strtof
+  if (any && mant < (1 << 24) && exp10 >= -10 && exp10 <= 10) {
+    float f = exp10 < 0 ? (float)mant / pow10[-exp10] : (float)mant * pow10[exp10];
+    *out = neg ? -f : f;
+    return s;
+  }
+
+  char buf[128], *end;
+  size_t n = 0;
+  while (start+n < e && n < sizeof(buf)-1 && !isspace((unsigned char)start[n])) n++;
+  memcpy(buf, start, n);
+  buf[n] = '\0';
+  float f = strtof(buf, &end);
+  if (end == buf) return NULL;
+  *out = f;
+  return start + (end - buf);
+}
+
 // list
 
 typedef struct {
@@ -111,6 +267,128 @@ void list_sort(list *l, int (*comp)(const void *, const void *)) {
   qsort(l->p, l->len, l->size, comp);
 }
 
+// threads
+
+// a fixed set of workers that split indexed jobs with the calling thread
+typedef struct {
+  void (*fn)(void *ctx, int job);
+  void *ctx;
+  int njobs, next, done, gen, quit, nthreads;
+#ifdef _WIN32
+  SRWLOCK lock;
+  CONDITION_VARIABLE work, finished;
+  HANDLE *threads;
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t work, finished;
+  pthread_t *threads;
+#endif
+} pool;
+
+#ifdef _WIN32
+  #define POOL_LOCK(p)         AcquireSRWLockExclusive(&(p)->lock)
+  #define POOL_UNLOCK(p)       ReleaseSRWLockExclusive(&(p)->lock)
+  #define POOL_WAIT(p, cv)     SleepConditionVariableSRW(&(p)->cv, &(p)->lock, INFINITE, 0)
+  #define POOL_BROADCAST(p, cv) WakeAllConditionVariable(&(p)->cv)
+#else
+  #define POOL_LOCK(p)         pthread_mutex_lock(&(p)->lock)
+  #define POOL_UNLOCK(p)       pthread_mutex_unlock(&(p)->lock)
+  #define POOL_WAIT(p, cv)     pthread_cond_wait(&(p)->cv, &(p)->lock)
+  #define POOL_BROADCAST(p, cv) pthread_cond_broadcast(&(p)->cv)
+#endif
+
+int cpu_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+#endif
+}
+
+// takes jobs until none are left, called with the lock held
+static void pool_drain(pool *p) {
+  while (p->next < p->njobs) {
+    int job = p->next++;
+    POOL_UNLOCK(p);
+    p->fn(p->ctx, job);
+    POOL_LOCK(p);
+    if (++p->done == p->njobs) POOL_BROADCAST(p, finished);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI pool_worker(LPVOID arg) {
+#else
+static void *pool_worker(void *arg) {
+#endif
+  pool *p = arg;
+  int gen = 0;
+  POOL_LOCK(p);
+  while (1) {
+    while (!p->quit && p->gen == gen) POOL_WAIT(p, work);
+    if (p->quit) break;
+    gen = p->gen;
+    pool_drain(p);
+  }
+  POOL_UNLOCK(p);
+  return 0;
+}
+
+// nthreads counts the caller, so a pool of 1 runs everything inline
+pool *pool_new(int nthreads) {
+  pool *p = calloc(1, sizeof(pool));
+  p->nthreads = nthreads > 1 ? nthreads : 1;
+#ifdef _WIN32
+  InitializeSRWLock(&p->lock);
+  InitializeConditionVariable(&p->work);
+  InitializeConditionVariable(&p->finished);
+  p->threads = calloc(p->nthreads, sizeof(HANDLE));
+  for (int i = 1; i < p->nthreads; i++)
+    p->threads[i] = CreateThread(NULL, 0, pool_worker, p, 0, NULL);
+#else
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->finished, NULL);
+  p->threads = calloc(p->nthreads, sizeof(pthread_t));
+  for (int i = 1; i < p->nthreads; i++)
+    pthread_create(&p->threads[i], NULL, pool_worker, p);
+#endif
+  return p;
+}
+
+// runs fn(ctx, 0..njobs-1) across the pool and waits for all of them
+void pool_run(pool *p, int njobs, void (*fn)(void *ctx, int job), void *ctx) {
+  if (njobs <= 0) return;
+  POOL_LOCK(p);
+  p->fn = fn; p->ctx = ctx;
+  p->njobs = njobs; p->next = p->done = 0;
+  p->gen++;
+  POOL_BROADCAST(p, work);
+  pool_drain(p);
+  while (p->done < p->njobs) POOL_WAIT(p, finished);
+  POOL_UNLOCK(p);
+}
+
+void pool_del(pool *p) {
+  POOL_LOCK(p);
+  p->quit = 1;
+  POOL_BROADCAST(p, work);
+  POOL_UNLOCK(p);
+  for (int i = 1; i < p->nthreads; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(p->threads[i], INFINITE);
+    CloseHandle(p->threads[i]);
+#else
+    pthread_join(p->threads[i], NULL);
+#endif
+  }
+  free(p->threads);
+  free(p);
+}
+
 // math
 
 typedef struct {
@@ -151,130 +429,549 @@ Vec project(Vec v0, int snap) {
   return v2;
 }
 
-Vec barycenter(Vec p, Vec v1, Vec v2, Vec v3) {
-  float d = (v2.y-v3.y) * (v1.x-v3.x) + (v3.x-v2.x) * (v1.y - v3.y);
-  float u = ((v2.y-v3.y) * (p.x-v3.x) + (v3.x-v2.x) * (p.y-v3.y)) / d;
-  float v = ((v3.y-v1.y) * (p.x-v3.x) + (v1.x-v3.x) * (p.y-v3.y)) / d;
-  float w = 1.0f - u - v;
-  Vec ret = {u, v, w}; return ret;
+// positions as separate coordinate streams
+
+typedef struct {
+  float *x, *y, *z;
+  int len;
+} Vecs;
+
+Vecs *vecs_new(int len) {
+  Vecs *vs = calloc(1, sizeof(Vecs));
+  vs->len = len;
+  vs->x = malloc(sizeof(float) * len);
+  vs->y = malloc(sizeof(float) * len);
+  vs->z = malloc(sizeof(float) * len);
+  return vs;
+}
+
+void vecs_del(Vecs *vs) {
+  free(vs->x);
+  free(vs->y);
+  free(vs->z);
+  free(vs);
+}
+
+Vec vecs_get(Vecs *vs, int idx) {
+  Vec v = {vs->x[idx], vs->y[idx], vs->z[idx]};
+  return v;
+}
+
+void vecs_set(Vecs *vs, int idx, Vec v) {
+  vs->x[idx] = v.x; vs->y[idx] = v.y; vs->z[idx] = v.z;
+}
+
+// perspective() followed by project() over whole streams. The vector
+// kernels do the same operations in the same order as the scalar
+// functions, so their results are bit-identical.
+
+void transform_scalar(Vecs *in, Vecs *view, Vecs *proj, int from, Vec x, Vec y, Vec z, int snap) {
+  for (int i = from; i < in->len; i++) {
+    Vec v = perspective(vecs_get(in, i), x, y, z);
+    vecs_set(view, i, v);
+    vecs_set(proj, i, project(v, snap));
+  }
+}
+
+#ifdef HAVE_SSE2
+// floorf for SSE2, which has no rounding instruction. Values at or above
+// 2^23 are integral already and are passed through, as are inf and nan.
+static __m128 floor_sse2(__m128 v) {
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+  t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1)));
+  __m128 big = _mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), v), _mm_set1_ps(8388608.0f));
+  return _mm_or_ps(_mm_and_ps(big, t), _mm_andnot_ps(big, v));
+}
+
+void transform_sse2(Vecs *in, Vecs *view, Vecs *proj, Vec x, Vec y, Vec z, int snap) {
+  float vs = fminf(HEIGHT, WIDTH)/2 * SCALE;
+  __m128 xx = _mm_set1_ps(x.x), xy = _mm_set1_ps(x.y), xz = _mm_set1_ps(x.z);
+  __m128 yx = _mm_set1_ps(y.x), yy = _mm_set1_ps(y.y), yz = _mm_set1_ps(y.z);
+  __m128 zx = _mm_set1_ps(z.x), zy = _mm_set1_ps(z.y), zz = _mm_set1_ps(z.z);
+  __m128 ud = _mm_set1_ps(DISTANCE), us = _mm_set1_ps(DISTANCE-1), s = _mm_set1_ps(vs);
+  __m128 cx = _mm_set1_ps(WIDTH/2), cy = _mm_set1_ps(HEIGHT/2);
+  int i = 0;
+  for (; i + 4 <= in->len; i += 4) {
+    __m128 px = _mm_loadu_ps(in->x+i), py = _mm_loadu_ps(in->y+i), pz = _mm_loadu_ps(in->z+i);
+    __m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, xx), _mm_mul_ps(py, xy)), _mm_mul_ps(pz, xz));
+    __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, yx), _mm_mul_ps(py, yy)), _mm_mul_ps(pz, yz));
+    __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, zx), _mm_mul_ps(py, zy)), _mm_mul_ps(pz, zz));
+    _mm_storeu_ps(view->x+i, vx); _mm_storeu_ps(view->y+i, vy); _mm_storeu_ps(view->z+i, vz);
+
+    __m128 d = _mm_add_ps(vz, ud);
+    __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_mul_ps(vx, us), d), s), cx);
+    __m128 sy = _mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_mul_ps(vy, us), d), s), cy);
+    __m128 sz = _mm_add_ps(_mm_div_ps(_mm_mul_ps(vz, us), d), ud);
+    if (snap) { sx = floor_sse2(sx); sy = floor_sse2(sy); }
+    _mm_storeu_ps(proj->x+i, sx); _mm_storeu_ps(proj->y+i, sy); _mm_storeu_ps(proj->z+i, sz);
+  }
+  transform_scalar(in, view, proj, i, x, y, z, snap);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 void transform_avx2(Vecs *in, Vecs *view, Vecs *proj, Vec x, Vec y, Vec z, int snap) {
+  float vs = fminf(HEIGHT, WIDTH)/2 * SCALE;
+  __m256 xx = _mm256_set1_ps(x.x), xy = _mm256_set1_ps(x.y), xz = _mm256_set1_ps(x.z);
+  __m256 yx = _mm256_set1_ps(y.x), yy = _mm256_set1_ps(y.y), yz = _mm256_set1_ps(y.z);
+  __m256 zx = _mm256_set1_ps(z.x), zy = _mm256_set1_ps(z.y), zz = _mm256_set1_ps(z.z);
+  __m256 ud = _mm256_set1_ps(DISTANCE), us = _mm256_set1_ps(DISTANCE-1), s = _mm256_set1_ps(vs);
+  __m256 cx = _mm256_set1_ps(WIDTH/2), cy = _mm256_set1_ps(HEIGHT/2);
+  int i = 0;
+  for (; i + 8 <= in->len; i += 8) {
+    __m256 px = _mm256_loadu_ps(in->x+i), py = _mm256_loadu_ps(in->y+i), pz = _mm256_loadu_ps(in->z+i);
+    __m256 vx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, xx), _mm256_mul_ps(py, xy)), _mm256_mul_ps(pz, xz));
+    __m256 vy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, yx), _mm256_mul_ps(py, yy)), _mm256_mul_ps(pz, yz));
+    __m256 vz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, zx), _mm256_mul_ps(py, zy)), _mm256_mul_ps(pz, zz));
+    _mm256_storeu_ps(view->x+i, vx); _mm256_storeu_ps(view->y+i, vy); _mm256_storeu_ps(view->z+i, vz);
+
+    __m256 d = _mm256_add_ps(vz, ud);
+    __m256 sx = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(vx, us), d), s), cx);
+    __m256 sy = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(vy, us), d), s), cy);
+    __m256 sz = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(vz, us), d), ud);
+    if (snap) { sx = _mm256_floor_ps(sx); sy = _mm256_floor_ps(sy); }
+    _mm256_storeu_ps(proj->x+i, sx); _mm256_storeu_ps(proj->y+i, sy); _mm256_storeu_ps(proj->z+i, sz);
+  }
+  transform_scalar(in, view, proj, i, x, y, z, snap);
+}
+
+int has_avx2(void) {
+  static int avx2 = -1;
+  if (avx2 < 0) { __builtin_cpu_init(); avx2 = __builtin_cpu_supports("avx2") != 0; }
+  return avx2;
+}
+#endif
+
+void transform(Vecs *in, Vecs *view, Vecs *proj, Vec x, Vec y, Vec z, int snap) {
+#ifdef HAVE_AVX2
+  if (has_avx2()) { transform_avx2(in, view, proj, x, y, z, snap); return; }
+#endif
+#ifdef HAVE_SSE2
+  transform_sse2(in, view, proj, x, y, z, snap);
+#else
+  transform_scalar(in, view, proj, 0, x, y, z, snap);
+#endif
+}
+
+// textures
+//
+// Every texture is prepared once at load for the rasterizers. Texels are
+// stored in the smallest of the PS1's formats that fits: 4 or 8-bit
+// indices into a color lookup table (CLUT) when there are at most 16 or
+// 256 distinct colors, 15-bit RGB with a 1-bit alpha when alpha is only
+// ever 0 or 255, and the image's own 32-bit pixels otherwise. The 15-bit
+// format drops the low 3 bits of each channel, as the PS1 would.
+//
+// Lighting can be quantized to SHADE_LEVELS intensities, so that a lit
+// texel of a CLUT texture is a single lookup into its CLUT shaded at
+// every level, built by tex_lit the first time it is needed. The other
+// formats multiply by the level's intensity, which is what such a table
+// would hold.
+//
+// Texel coordinates wrap around with a mask when the sides are powers of
+// two, with a modulo otherwise. While the blocked layout is on, power of
+// two textures also get a copy laid out in TEX_BLOCK x TEX_BLOCK blocks
+// of texels, built by tex_blocks, so that walking across the texture in
+// any direction, not just along its rows, touches few cache lines.
+
+#define TEX_BLOCK 4  // the addressing below assumes 4
+#define TEX_PAD 4    // readable bytes past the texels, for 32-bit gathers
+#define SHADE_LEVELS 32
+#define SHADE_INTENSITY(l) ((l) * (256 / SHADE_LEVELS) + 128 / SHADE_LEVELS)
+
+enum { TEX_RGBA = 0, TEX_CLUT4, TEX_CLUT8, TEX_RGB555 };
+
+typedef struct Texture {
+  int w, h, format;
+  int wmask, hmask;   // w-1 and h-1 if powers of two, else -1
+  int bshift;         // log2 of the blocks in a row, -1 without power of two sides
+  unsigned char *pix; // rows of texels, owned unless TEX_RGBA
+  unsigned char *blocks;  // the same in blocks, once tex_blocks built them
+  TPixel clut[256];
+  TPixel *lit;        // the CLUT at every shading level, once tex_lit built it
+  int opaque;         // no texel has any transparency
+} Texture;
+
+// what the rasterizers read texels through
+typedef struct {
+  unsigned char *pix;
+  TPixel *clut, *lit;
+  int format, w, h, wmask, hmask, bshift;
+  int blocked;        // pix is in blocks
+  int quantize;       // shading is quantized to SHADE_LEVELS
+} Sampler;
+
+static int log2i(int n) {
+  int k = 0;
+  while ((1 << k) < n) k++;
+  return (1 << k) == n ? k : -1;
+}
+
+static unsigned tex_packed(TPixel p) {
+  return p.r | p.g << 8 | p.b << 16 | (unsigned)p.a << 24;
+}
+
+static int tex_cmp(const void *a, const void *b) {
+  unsigned x = *(const unsigned*)a, y = *(const unsigned*)b;
+  return (x > y) - (x < y);
+}
+
+static TPixel rgb555(unsigned short c) {
+  int r = c & 31, g = (c >> 5) & 31, b = (c >> 10) & 31;
+  TPixel p = {r << 3 | r >> 2, g << 3 | g >> 2, b << 3 | b >> 2, c >> 15 ? 0xFF : 0};
+  return p;
+}
+
+static int tex_bytes(int format, int n) {
+  switch (format) {
+    case TEX_CLUT4: return (n + 1) / 2 + TEX_PAD;
+    case TEX_CLUT8: return n + TEX_PAD;
+    case TEX_RGB555: return n * 2 + TEX_PAD;
+    default: return n * sizeof(TPixel);
+  }
+}
+
+// stores texel value c at index i, c being what the format holds
+static void tex_put(unsigned char *pix, int format, int i, unsigned c) {
+  switch (format) {
+    case TEX_CLUT4: pix[i >> 1] |= c << ((i & 1) << 2); break;
+    case TEX_CLUT8: pix[i] = c; break;
+    case TEX_RGB555: ((unsigned short*)pix)[i] = c; break;
+    default: ((unsigned*)pix)[i] = c;
+  }
+}
+
+// the texel value at index i, as tex_put stored it
+static unsigned tex_get(const unsigned char *pix, int format, int i) {
+  switch (format) {
+    case TEX_CLUT4: return (pix[i >> 1] >> ((i & 1) << 2)) & 15;
+    case TEX_CLUT8: return pix[i];
+    case TEX_RGB555: return ((const unsigned short*)pix)[i];
+    default: return ((const unsigned*)pix)[i];
+  }
+}
+
+// sets the masks and block layout that follow from t's size
+static void tex_shape(Texture *t) {
+  int lw = log2i(t->w), lh = log2i(t->h);
+  t->wmask = lw >= 0 ? t->w-1 : -1;
+  t->hmask = lh >= 0 ? t->h-1 : -1;
+  t->bshift = lw >= 2 && lh >= 2 ? lw - 2 : -1;
+}
+
+Texture *tex_new(Tigr *img) {
+  Texture *t = calloc(1, sizeof(Texture));
+  int n = img->w * img->h;
+  t->w = img->w; t->h = img->h;
+
+  // distinct colors, sorted, become the CLUT
+  unsigned *c = malloc(sizeof(unsigned) * n);
+  int colors = 0, binary = 1;
+  t->opaque = 1;
+  for (int i = 0; i < n; i++) {
+    c[i] = tex_packed(img->pix[i]);
+    binary &= img->pix[i].a == 0 || img->pix[i].a == 0xFF;
+    t->opaque &= img->pix[i].a == 0xFF;
+  }
+  qsort(c, n, sizeof(unsigned), tex_cmp);
+  for (int i = 0; i < n; i++)
+    if (i == 0 || c[i] != c[i-1]) c[colors++] = c[i];
+
+  if (colors <= 16) t->format = TEX_CLUT4;
+  else if (colors <= 256) t->format = TEX_CLUT8;
+  else if (binary) t->format = TEX_RGB555;
+  else t->format = TEX_RGBA;
+  for (int i = 0; i < colors && i < 256; i++) {
+    TPixel p = {c[i], c[i] >> 8, c[i] >> 16, c[i] >> 24};
+    t->clut[i] = p;
+  }
+
+  // texel values in the chosen format, in rows
+  unsigned *texel = malloc(sizeof(unsigned) * n);
+  for (int i = 0; i < n; i++) {
+    TPixel p = img->pix[i];
+    unsigned k = tex_packed(p);
+    if (t->format == TEX_CLUT4 || t->format == TEX_CLUT8)
+      texel[i] = (unsigned*)bsearch(&k, c, colors, sizeof(unsigned), tex_cmp) - c;
+    else if (t->format == TEX_RGB555)
+      texel[i] = p.a ? (p.r >> 3 | (p.g >> 3) << 5 | (p.b >> 3) << 10 | 0x8000) : 0;
+    else
+      texel[i] = k;
+  }
+  free(c);
+
+  if (t->format == TEX_RGBA) {
+    t->pix = (unsigned char*)img->pix;
+  } else {
+    t->pix = calloc(1, tex_bytes(t->format, n));
+    for (int i = 0; i < n; i++) tex_put(t->pix, t->format, i, texel[i]);
+  }
+
+  tex_shape(t);
+  free(texel);
+  return t;
+}
+
+// CLUT entries a format reads, 0 if it has no CLUT
+static int tex_colors(int format) {
+  return format == TEX_CLUT4 ? 16 : format == TEX_CLUT8 ? 256 : 0;
+}
+
+// a texture over texels tex_new converted before, as the cache stores
+// them. pix isn't copied: the caller keeps it alive and, unless TEX_RGBA,
+// clears it before tex_del
+Texture *tex_wrap(int w, int h, int format, int opaque, const TPixel *clut, unsigned char *pix) {
+  Texture *t = calloc(1, sizeof(Texture));
+  t->w = w; t->h = h;
+  t->format = format;
+  t->opaque = opaque;
+  if (clut) memcpy(t->clut, clut, sizeof(TPixel) * tex_colors(format));
+  t->pix = pix;
+  tex_shape(t);
+  return t;
+}
+
+static TPixel tex_light(TPixel p, int intensity) {
+  p.r = (p.r * intensity) >> 8;
+  p.g = (p.g * intensity) >> 8;
+  p.b = (p.b * intensity) >> 8;
+  return p;
+}
+
+static int shade_level(int shading) {
+  return shading < 256 ? shading * SHADE_LEVELS >> 8 : SHADE_LEVELS - 1;
+}
+
+// builds the shaded CLUTs of a CLUT texture, if not done yet
+void tex_lit(Texture *t) {
+  if (t == NULL || t->lit || !tex_colors(t->format)) return;
+  int n = tex_colors(t->format);
+  t->lit = malloc(sizeof(TPixel) * SHADE_LEVELS * n);
+  for (int l = 0; l < SHADE_LEVELS; l++)
+    for (int i = 0; i < n; i++) t->lit[l * n + i] = tex_light(t->clut[i], SHADE_INTENSITY(l));
+}
+
+// lays out t's texels in blocks too while on, if it has power of two
+// sides, and drops that copy again once off
+void tex_blocks(Texture *t, int on) {
+  if (t == NULL) return;
+  if (!on) { free(t->blocks); t->blocks = NULL; return; }
+  if (t->blocks || t->bshift < 0) return;
+  t->blocks = calloc(1, tex_bytes(t->format, t->w * t->h));
+  for (int y = 0; y < t->h; y++)
+    for (int x = 0; x < t->w; x++)
+      tex_put(t->blocks, t->format, (((y >> 2) << t->bshift) + (x >> 2)) * 16 + ((y & 3) << 2) + (x & 3),
+              tex_get(t->pix, t->format, y * t->w + x));
+}
+
+void tex_del(Texture *t) {
+  if (t == NULL) return;
+  if (t->format != TEX_RGBA) free(t->pix);
+  free(t->blocks);
+  free(t->lit);
+  free(t);
+}
+
+Sampler tex_sampler(Texture *t, int blocked, int quantize) {
+  Sampler s = {t->pix, t->clut, t->lit, t->format, t->w, t->h, t->wmask, t->hmask, t->bshift, 0, quantize};
+  if (blocked && t->blocks) { s.pix = t->blocks; s.blocked = 1; }
+  return s;
+}
+
+// where the texel at (tx, y), wrapped around, is in s->pix
+static int tex_index(Sampler *s, int tx, int ty) {
+  if (s->wmask >= 0) tx &= s->wmask; else if ((tx %= s->w) < 0) tx += s->w;
+  if (s->hmask >= 0) ty &= s->hmask; else if ((ty %= s->h) < 0) ty += s->h;
+  if (s->blocked) return (((ty >> 2) << s->bshift) + (tx >> 2)) * 16 + ((ty & 3) << 2) + (tx & 3);
+  return ty * s->w + tx;
+}
+
+static TPixel tex_texel(Sampler *s, int i) {
+  switch (s->format) {
+    case TEX_CLUT4: return s->clut[(s->pix[i >> 1] >> ((i & 1) << 2)) & 15];
+    case TEX_CLUT8: return s->clut[s->pix[i]];
+    case TEX_RGB555: return rgb555(((unsigned short*)s->pix)[i]);
+    default: return ((TPixel*)s->pix)[i];
+  }
+}
+
+// the texel at (tx, ty) lit by intensity shading, -1 for unlit
+INLINE TPixel tex_fetch(Sampler *s, int tx, int ty, int shading) {
+  int i = tex_index(s, tx, ty);
+  if (shading < 0) return tex_texel(s, i);
+  if (!s->quantize) return tex_light(tex_texel(s, i), shading);
+  int level = shade_level(shading);
+  if (s->lit && s->format == TEX_CLUT4) return s->lit[level << 4 | ((s->pix[i >> 1] >> ((i & 1) << 2)) & 15)];
+  if (s->lit && s->format == TEX_CLUT8) return s->lit[level << 8 | s->pix[i]];
+  return tex_light(tex_texel(s, i), SHADE_INTENSITY(level));
 }
 
 // obj/mtl
 
-typedef struct Mtl {
+typedef struct {
   char *name;
-  Tigr *map_Ka, *map_Kd;
-
-  struct Mtl *next;
+  Tigr *map_Ka, *map_Kd;  // as read, freed by mtl_textures unless texture uses its pixels
+  Texture *texture;    // map_Ka, or map_Kd without it, prepared at load
 } Mtl;
 
 typedef struct {
   int v1, v2, v3;
   int vt1, vt2, vt3;
   int vn1, vn2, vn3;
-  Mtl *mtl;
+  int mtl;             // index into Obj.mtl, -1 if none
 } Face;
 
 typedef struct {
-  list *v, *vn, *vt, *f;
-  Mtl *mtl;
+  Vecs *v;
+  list *vn, *vt, *f;
+  list *mtl;           // Mtl
+  list *files;         // char*, every file the model was built from
+  mfile *cache;        // backing store of the lists when loaded from cache
 } Obj;
 
-Mtl* mtl_readfile(const char *filepath) {
+static Tigr *mtl_readimage(const char *name, const char *filepath, list *files) {
+  char *imgpath = relpath(name, filepath);
+  Tigr *img = tigrLoadImage(imgpath);
+  if (img == NULL) error("failed to open image: {%s}", imgpath);
+  list_add(files, &imgpath);
+  return img;
+}
+
+void mtl_readfile(const char *filepath, list *mtl, list *files) {
   FILE *f = fopen(filepath, "r");
   if (f == NULL) error("failed to open mtl file: %s", filepath);
 
   char *line = NULL, *tline = NULL;
   size_t len = 0;
 
-  Mtl *m = NULL;
+  int first = mtl->len;
 
   while (readline(&line, &len, f) != -1) {
     tline = trim(line);
+    Mtl *m = mtl->len > first ? (Mtl*)list_get(mtl, mtl->len-1) : NULL;
     if (strncmp(tline, "newmtl ", 7) == 0) {
-      char *mtlname = &line[7];
-      Mtl *newm = calloc(1, sizeof(Mtl));
-      newm->name = strdup(mtlname);
-      newm->next = m;
-      m = newm;
+      Mtl newm = {strdup(&line[7]), NULL, NULL, NULL};
+      list_add(mtl, &newm);
     } else if (strncmp(tline, "map_Ka ", 7) == 0 && m != NULL) {
-      char *imgname = strdup(tline+7);
-      char *imgpath = relpath(imgname, filepath);
-      Tigr *img = tigrLoadImage(imgpath);
-      if (img == NULL) error("failed to open image: {%s}", imgpath);
-      m->map_Ka = img;
-      free(imgpath);
-      free(imgname);
+      m->map_Ka = mtl_readimage(tline+7, filepath, files);
     } else if (strncmp(tline, "map_Kd ", 7) == 0 && m != NULL) {
-      char *imgname = strdup(tline+7);
-      char *imgpath = relpath(imgname, filepath);
-      Tigr *img = tigrLoadImage(imgpath);
-      if (img == NULL) error("failed to open image: {%s}", imgpath);
-      m->map_Kd = img;
-      free(imgpath);
-      free(imgname);
+      m->map_Kd = mtl_readimage(tline+7, filepath, files);
     }
   }
   free(line);
   fclose(f);
-  return m;
 }
 
-Mtl* mtl_get(Mtl *mtl, const char *name) {
-  while (mtl != NULL && strcmp(mtl->name, name) != 0) mtl = mtl->next;
-  return mtl;
+// the last definition wins when a name is reused
+int mtl_get(list *mtl, const char *name) {
+  int i = mtl->len-1;
+  while (i >= 0 && strcmp(((Mtl*)list_get(mtl, i))->name, name) != 0) i--;
+  return i;
 }
 
-void mtl_del(Mtl *mtl) {
-  Mtl *next;
-  while (mtl != NULL) {
-    free(mtl->name);
-    if (mtl->map_Ka != NULL) tigrFree(mtl->map_Ka);
-    if (mtl->map_Kd != NULL) tigrFree(mtl->map_Kd);
-    next = mtl->next;
-    free(mtl);
-    mtl = next;
+// prepares the texture of every material once its images are loaded,
+// then frees the images, except one a TEX_RGBA texture still reads
+void mtl_textures(list *mtl) {
+  for (int i = 0; i < mtl->len; i++) {
+    Mtl *m = (Mtl*)list_get(mtl, i);
+    Tigr *img = m->map_Ka ? m->map_Ka : m->map_Kd;
+    if (img && !m->texture) m->texture = tex_new(img);
+    Tigr *keep = m->texture && m->texture->format == TEX_RGBA ? img : NULL;
+    if (m->map_Ka && m->map_Ka != keep) { tigrFree(m->map_Ka); m->map_Ka = NULL; }
+    if (m->map_Kd && m->map_Kd != keep) { tigrFree(m->map_Kd); m->map_Kd = NULL; }
   }
 }
 
-Obj* obj_readfile(char *filepath) {
-  Obj *o = calloc(1, sizeof(Obj));
-  o->v = list_new(sizeof(Vec));
-  o->vn = list_new(sizeof(Vec));
-  o->vt = list_new(sizeof(Vec));
-  o->f = list_new(sizeof(Face));
+void mtl_del(list *mtl) {
+  for (int i = 0; i < mtl->len; i++) {
+    Mtl *m = (Mtl*)list_get(mtl, i);
+    free(m->name);
+    tex_del(m->texture);
+    if (m->map_Ka != NULL) tigrFree(m->map_Ka);
+    if (m->map_Kd != NULL) tigrFree(m->map_Kd);
+  }
+  list_del(mtl);
+}
 
-  FILE *f = fopen(filepath, "r");
-  if (f == NULL) error("failed to open obj file: %s", filepath);
+// parses up to three floats, missing ones are left untouched
+static void scan_vec(const char *s, const char *e, Vec *v) {
+  if ((s = scan_float(s, e, &v->x)) && (s = scan_float(s, e, &v->y))) scan_float(s, e, &v->z);
+}
 
-  char *line = NULL;
-  size_t len = 0;
+// parses a single vertex reference of a face: v, v/vt, v//vn or v/vt/vn
+static const char *scan_fvert(const char *s, const char *e, int *v, int *vt, int *vn) {
+  *vt = *vn = 0;
+  if ((s = scan_int(s, e, v)) == NULL) return NULL;
+  if (s == e || *s != '/') return s;
+  const char *t;
+  if (s+1 < e && s[1] == '/') {
+    if ((t = scan_int(s+2, e, vn)) != NULL) s = t;
+  } else if ((t = scan_int(s+1, e, vt)) != NULL) {
+    s = t;
+    if (s < e && *s == '/' && (t = scan_int(s+1, e, vn)) != NULL) s = t;
+    else *vn = 0;
+  }
+  return s;
+}
 
-  Mtl *mtl = NULL;
+static char *line_str(const char *s, const char *e) {
+  while (e > s && e[-1] == '\r') e--;
+  char *str = malloc(e-s+1);
+  memcpy(str, s, e-s);
+  str[e-s] = '\0';
+  return str;
+}
+
+// smallest slice of an obj file worth handing to a separate thread
+#define OBJ_CHUNK (1 << 20)
+
+// material directives are only recorded while chunks are parsed and are
+// replayed in file order afterwards, since a chunk can't know which
+// material is active at its start.
+typedef struct {
+  enum { OBJ_MTLLIB, OBJ_USEMTL } kind;
+  int face;       // number of faces of the chunk preceding the directive
+  char *name;
+  int mtl;        // resolved usemtl target
+} ObjEvent;
+
+typedef struct {
+  const char *s, *e;
+  list *v, *vn, *vt, *f, *ev;
+  int v_at, vn_at, vt_at, f_at;  // offsets into the merged lists
+  int mtl;                       // material active at the chunk start
+} ObjChunk;
+
+static void obj_parse_chunk(void *ctx, int idx) {
+  ObjChunk *c = (ObjChunk*)ctx + idx;
+  c->v = list_new(sizeof(Vec));
+  c->vn = list_new(sizeof(Vec));
+  c->vt = list_new(sizeof(Vec));
+  c->f = list_new(sizeof(Face));
+  c->ev = list_new(sizeof(ObjEvent));
+
+  const char *line = c->s, *end = c->e;
+  while (line < end) {
+    const char *eol = memchr(line, '\n', end-line);
+    if (eol == NULL) eol = end;
+    size_t len = eol - line;
 
-  while (readline(&line, &len, f) != -1) {
     Vec v = {0, 0, 0};
-    if (strncmp(line, "v ", 2) == 0) {
-      sscanf(line, "v %f %f %f", &v.x, &v.y, &v.z);
-      list_add(o->v, &v);
-    } else if (strncmp(line, "vn ", 3) == 0) {
-      sscanf(line, "vn %f %f %f", &v.x, &v.y, &v.z);
-      list_add(o->vn, &v);
-    } else if (strncmp(line, "vt ", 3) == 0) {
-      sscanf(line, "vt %f %f %f", &v.x, &v.y, &v.z);
-      list_add(o->vt, &v);
-    } else if (strncmp(line, "f ", 2) == 0) {
-      int offset = 2;
+    if (len >= 2 && line[0] == 'v' && line[1] == ' ') {
+      scan_vec(line+2, eol, &v);
+      list_add(c->v, &v);
+    } else if (len >= 3 && line[0] == 'v' && line[1] == 'n' && line[2] == ' ') {
+      scan_vec(line+3, eol, &v);
+      list_add(c->vn, &v);
+    } else if (len >= 3 && line[0] == 'v' && line[1] == 't' && line[2] == ' ') {
+      scan_vec(line+3, eol, &v);
+      list_add(c->vt, &v);
+    } else if (len >= 2 && line[0] == 'f' && line[1] == ' ') {
+      const char *p = line+2;
       int i = 0, v1, v2, v3, vt1, vt2, vt3, vn1, vn2, vn3;
       while (++i) {
-        int v = 0, vt = 0, vn = 0, nread = 0;
-        if (!(
-          sscanf(line+offset, "%d/%d/%d%n", &v, &vt, &vn, &nread) >= 3 ||
-          sscanf(line+offset, "%d/%d%n", &v, &vt, &nread) >= 2 ||
-          sscanf(line+offset, "%d//%d%n", &v, &vn, &nread) >= 2 ||
-          sscanf(line+offset, "%d%n", &v, &nread) >= 1
-        )) break;
-        offset += nread;
+        int v, vt, vn;
+        if ((p = scan_fvert(p, eol, &v, &vt, &vn)) == NULL) break;
 
         if (i == 1) { v1 = v; vt1 = vt; vn1 = vn; continue; }
         v2 = v3; v3 = v;
@@ -284,41 +981,158 @@ Obj* obj_readfile(char *filepath) {
         if (i >= 3) {
           Face f = {
             .v1=v1, .v2=v2, .v3=v3, .vt1=vt1, .vt2=vt2, .vt3=vt3,
-            .vn1=vn1, .vn2=vn2, .vn3=vn3, .mtl=mtl
+            .vn1=vn1, .vn2=vn2, .vn3=vn3, .mtl=-1
           };
-          list_add(o->f, &f);
+          list_add(c->f, &f);
         }
       }
-    } else if (strncmp(line, "mtllib ", 7) == 0) {
-      char *mtlname = line+7;
-      char *mtlpath = relpath(mtlname, filepath);
-      o->mtl = mtl_readfile(mtlpath);
-      free(mtlpath);
-    } else if (strncmp(line, "usemtl ", 7) == 0) {
-      char *name = line+7;
-      mtl = mtl_get(o->mtl, name);
-      if (mtl == NULL) error("failed to find mtl: %s", name);
+    } else if (len >= 7 && strncmp(line, "mtllib ", 7) == 0) {
+      ObjEvent ev = {OBJ_MTLLIB, c->f->len, line_str(line+7, eol), -1};
+      list_add(c->ev, &ev);
+    } else if (len >= 7 && strncmp(line, "usemtl ", 7) == 0) {
+      ObjEvent ev = {OBJ_USEMTL, c->f->len, line_str(line+7, eol), -1};
+      list_add(c->ev, &ev);
     }
+    line = eol+1;
   }
-  free(line);
-  fclose(f);
+}
+
+// assigns materials to the faces of a chunk and copies it into the merged
+// lists, unless the chunk's lists already are the merged ones
+static void obj_merge_chunk(void *ctx, int idx) {
+  Obj *o = ((Obj**)ctx)[0];
+  ObjChunk *c = (ObjChunk*)((Obj**)ctx)[1] + idx;
+
+  Face *f = (Face*)c->f->p;
+  int mtl = c->mtl;
+  for (int i = 0, j = 0; i < c->f->len; i++) {
+    for (; j < c->ev->len && ((ObjEvent*)list_get(c->ev, j))->face == i; j++) {
+      ObjEvent *ev = (ObjEvent*)list_get(c->ev, j);
+      if (ev->kind == OBJ_USEMTL) mtl = ev->mtl;
+    }
+    f[i].mtl = mtl;
+  }
+  for (int i = 0; i < c->v->len; i++) vecs_set(o->v, c->v_at + i, *(Vec*)list_get(c->v, i));
+  list_del(c->v);
+  if (o->f == c->f) return;
+
+  memcpy((Vec*)o->vn->p + c->vn_at, c->vn->p, c->vn->len * sizeof(Vec));
+  memcpy((Vec*)o->vt->p + c->vt_at, c->vt->p, c->vt->len * sizeof(Vec));
+  memcpy((Face*)o->f->p + c->f_at, c->f->p, c->f->len * sizeof(Face));
+  list_del(c->vn); list_del(c->vt); list_del(c->f);
+}
+
+Obj* obj_readfile(char *filepath, pool *pool) {
+  Obj *o = calloc(1, sizeof(Obj));
+  o->mtl = list_new(sizeof(Mtl));
+  o->files = list_new(sizeof(char*));
+  char *path = strdup(filepath);
+  list_add(o->files, &path);
+
+  double t = now();
+  mfile *m = mfile_open(filepath, 0);
+  if (m == NULL) error("failed to open obj file: %s", filepath);
+
+  // split at line boundaries, a few chunks per thread to even out the load
+  int nchunks = pool->nthreads > 1 ? pool->nthreads * 4 : 1;
+  if ((size_t)nchunks > m->len / OBJ_CHUNK) nchunks = m->len / OBJ_CHUNK ?: 1;
+
+  ObjChunk *chunks = calloc(nchunks, sizeof(ObjChunk));
+  const char *pos = m->p, *end = m->p + m->len;
+  for (int i = 0; i < nchunks; i++) {
+    const char *e = end;
+    if (i < nchunks-1) {
+      e = m->p + m->len / nchunks * (i+1);
+      if (e < pos) e = pos;
+      const char *eol = memchr(e, '\n', end-e);
+      e = eol == NULL ? end : eol+1;
+    }
+    chunks[i].s = pos;
+    chunks[i].e = pos = e;
+  }
+  pool_run(pool, nchunks, obj_parse_chunk, chunks);
+
+  int nv = 0;
+  for (int i = 0; i < nchunks; i++) nv += chunks[i].v->len;
+  o->v = vecs_new(nv);
+  if (nchunks == 1) {
+    o->vn = chunks[0].vn; o->vt = chunks[0].vt; o->f = chunks[0].f;
+  } else {
+    o->vn = list_new(sizeof(Vec));
+    o->vt = list_new(sizeof(Vec));
+    o->f = list_new(sizeof(Face));
+  }
+
+  // prefix sums give each chunk its place in the merged lists,
+  // material directives are resolved sequentially in file order
+  int mtl = -1;
+  for (int i = 0; i < nchunks; i++) {
+    ObjChunk *c = &chunks[i];
+    c->v_at = i > 0 ? chunks[i-1].v_at + chunks[i-1].v->len : 0;
+    c->vn_at = o->vn->len; c->vt_at = o->vt->len; c->f_at = o->f->len;
+    if (nchunks > 1) {
+      o->vn->len += c->vn->len; o->vt->len += c->vt->len; o->f->len += c->f->len;
+    }
+    c->mtl = mtl;
+    for (int j = 0; j < c->ev->len; j++) {
+      ObjEvent *ev = (ObjEvent*)list_get(c->ev, j);
+      if (ev->kind == OBJ_MTLLIB) {
+        char *mtlpath = relpath(ev->name, filepath);
+        mtl_readfile(mtlpath, o->mtl, o->files);
+        list_add(o->files, &mtlpath);
+      } else {
+        mtl = ev->mtl = mtl_get(o->mtl, ev->name);
+        if (mtl < 0) error("failed to find mtl: %s", ev->name);
+      }
+    }
+  }
+
+  list *lists[] = {o->vn, o->vt, o->f};
+  for (int i = 0; i < 3 && nchunks > 1; i++) {
+    lists[i]->cap = lists[i]->len;
+    lists[i]->p = malloc((size_t)lists[i]->size * lists[i]->cap);
+  }
+  void *ctx[] = {o, chunks};
+  pool_run(pool, nchunks, obj_merge_chunk, ctx);
+
+  for (int i = 0; i < nchunks; i++) {
+    for (int j = 0; j < chunks[i].ev->len; j++) free(((ObjEvent*)list_get(chunks[i].ev, j))->name);
+    list_del(chunks[i].ev);
+  }
+  free(chunks);
+
+  t = now() - t;
+  printf("parsed %s: %.1f MB in %.3fs (%.1f MB/s, %d threads)\n",
+    filepath, m->len/1e6, t, m->len/1e6/t, pool->nthreads);
+  mfile_close(m);
 
   return o;
 }
 
 void obj_del(Obj *o) {
+  list *lists[] = {o->vn, o->vt, o->f};
+  if (o->cache) {
+    // lists and texels point into the cache mapping
+    if (o->v) o->v->x = o->v->y = o->v->z = NULL;
+    for (int i = 0; i < 3; i++) if (lists[i]) lists[i]->p = NULL;
+    for (int i = 0; i < o->mtl->len; i++) {
+      Texture *t = ((Mtl*)list_get(o->mtl, i))->texture;
+      if (t) t->pix = NULL;
+    }
+    mfile_close(o->cache);
+  }
+  if (o->v) vecs_del(o->v);
+  for (int i = 0; i < 3; i++) if (lists[i]) list_del(lists[i]);
+  for (int i = 0; i < o->files->len; i++) free(*(char**)list_get(o->files, i));
+  list_del(o->files);
   mtl_del(o->mtl);
-  list_del(o->v);
-  list_del(o->vn);
-  list_del(o->vt);
-  list_del(o->f);
   free(o);
 }
 
 void obj_normalize(Obj *obj) {
   Vec min = {FLT_MAX, FLT_MAX, FLT_MAX}, max = {FLT_MIN, FLT_MIN, FLT_MIN};
   for (int i = 0; i < obj->v->len; i++) {
-    Vec v = VREF(list_get(obj->v, i));
+    Vec v = vecs_get(obj->v, i);
     min.x = fminf(min.x, v.x); max.x = fmaxf(max.x, v.x);
     min.y = fminf(min.y, v.y); max.y = fmaxf(max.y, v.y);
     min.z = fminf(min.z, v.z); max.z = fmaxf(max.z, v.z);
@@ -328,10 +1142,11 @@ void obj_normalize(Obj *obj) {
   float W = fmaxf(fmaxf(size.x, size.y), size.z);
 
   for (int i = 0; i < obj->v->len; i++) {
-    Vec *v = (Vec*)list_get(obj->v, i);
-    v->x = ((v->x - min.x) / W*2 - size.x/W);
-    v->y = -((v->y - min.y) / W*2 - size.y/W);
-    v->z = -((v->z - min.z) / W*2 - size.z/W);
+    Vec v = vecs_get(obj->v, i);
+    v.x = ((v.x - min.x) / W*2 - size.x/W);
+    v.y = -((v.y - min.y) / W*2 - size.y/W);
+    v.z = -((v.z - min.z) / W*2 - size.z/W);
+    vecs_set(obj->v, i, v);
   }
 
   for (int i = 0; i < obj->vn->len; i++) {
@@ -345,9 +1160,8 @@ void obj_normalize(Obj *obj) {
 
 void obj_flip(Obj *obj) {
   for (int i = 0; i < obj->v->len; i++) {
-    Vec *v = (Vec*)list_get(obj->v, i);
-    v->y = -v->y;
-    v->z = -v->z;
+    obj->v->y[i] = -obj->v->y[i];
+    obj->v->z[i] = -obj->v->z[i];
   }
   for (int i = 0; i < obj->vn->len; i++) {
     Vec *vn = (Vec*)list_get(obj->vn, i);
@@ -356,190 +1170,2196 @@ void obj_flip(Obj *obj) {
   }
 }
 
-// main
+// cache
+//
+// A normalized model is written next to its source as <path>.tipsy and
+// mapped straight back into the Obj lists on later runs. The file starts
+// with a header and the list of source files it was built from, followed
+// by the raw arrays, each aligned to CACHE_ALIGN bytes:
+//
+//   header | files | v.x | v.y | v.z | vn | vt | f | materials
+//
+// Every file entry stores mtime and size, any mismatch rebuilds the cache.
+// Materials are stored as name and the texture tex_new converted their
+// image to, its CLUT if the format has one and its texels, which are read
+// straight from the mapping.
+
+#define CACHE_MAGIC "tipsy\0\0\5"
+#define CACHE_ALIGN 32
 
 typedef struct {
-  int draw_wireframe, use_zbuffer, use_pcorrect, inv_bculling, jitter;
-  enum { SHADING_NONE = 0, SHADING_FLAT, SHADING_GOURAUD } shading;
-  Vec x, y, z;
-  float *zbuff;
-} State;
+  char magic[8];
+  int nv, nvn, nvt, nf, nmtl, nfiles;
+} CacheHeader;
 
 typedef struct {
-  Vec v1, v2, v3;
-  Vec vn1, vn2, vn3;
-  Vec nrm;
-  int idx;
-} Surface;
-
-int surface_cmp(const void *a, const void *b) {
-  Surface sa = *(Surface*)a;
-  Surface sb = *(Surface*)b;
+  long long mtime, size;
+  int len;
+} CacheFile;
 
-  float amaxz = fmaxf(fmaxf(sa.v1.z, sa.v2.z), sa.v3.z);
-  float bmaxz = fmaxf(fmaxf(sb.v1.z, sb.v2.z), sb.v3.z);
-
-  int apoints = (sa.v1.z < bmaxz) + (sa.v2.z < bmaxz) + (sa.v3.z < bmaxz);
-  int bpoints = (sb.v1.z < amaxz) + (sb.v2.z < amaxz) + (sb.v3.z < amaxz);
-
-  return apoints - bpoints;
+typedef struct {
+  int len;
+  int w, h, format, opaque;  // of the texture, format -1 without one
+} CacheMtl;
+
+static void cache_put(FILE *f, const void *p, size_t n) {
+  static const char pad[CACHE_ALIGN];
+  fwrite(p, 1, n, f);
+  fwrite(pad, 1, (CACHE_ALIGN - n % CACHE_ALIGN) % CACHE_ALIGN, f);
 }
 
-int shade(Vec nrm, Vec bc) {
-  static Vec lights = {-1, -1, -1};
-  Vec var = {vec_dot(lights, nrm), vec_dot(lights, nrm), vec_dot(lights, nrm)};
-  float intensity = vec_dot(bc, var);
-  return 0xFF * fminf(fmaxf(0.3, intensity), 1);
+static void *cache_take(char **pos, char *end, size_t n) {
+  size_t padded = (n + CACHE_ALIGN-1) / CACHE_ALIGN * CACHE_ALIGN;
+  if ((size_t)(end - *pos) < padded) return NULL;
+  void *p = *pos;
+  *pos += padded;
+  return p;
 }
 
-void draw_wireframe(Tigr *scr, Surface sf, TPixel color) {
-  tigrLine(scr, sf.v1.x, sf.v1.y, sf.v2.x, sf.v2.y, color);
-  tigrLine(scr, sf.v2.x, sf.v2.y, sf.v3.x, sf.v3.y, color);
-  tigrLine(scr, sf.v3.x, sf.v3.y, sf.v1.x, sf.v1.y, color);
+static int cache_stat(const char *path, CacheFile *cf) {
+  struct stat st;
+  if (stat(path, &st) != 0) return -1;
+  cf->mtime = st.st_mtime;
+  cf->size = st.st_size;
+  cf->len = strlen(path);
+  return 0;
 }
 
-void draw_surface(Tigr *scr, Obj *obj, Surface sf, State state) {
-  Face f = *(Face*)(list_get(obj->f, sf.idx));
-
-  Tigr *texture = NULL;
-  if (f.mtl) texture = f.mtl->map_Ka ? f.mtl->map_Ka : f.mtl->map_Kd;
-  if (texture == NULL) return;
-
-  int shading = -1, has_normals = 0;
-  Vec vn1, vn2, vn3;
+char *cache_path(const char *filepath) {
+  char *path = malloc(strlen(filepath) + 7);
+  sprintf(path, "%s.tipsy", filepath);
+  return path;
+}
 
-  if (state.shading == SHADING_FLAT) {
-    Vec bc = {0.333, 0.333, 0.333};
-    shading = shade(sf.nrm, bc);
+void obj_writecache(Obj *o, const char *filepath) {
+  char *path = cache_path(filepath);
+  char *tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+
+  FILE *f = fopen(tmp, "wb");
+  if (f == NULL) { free(tmp); free(path); return; }
+
+  CacheHeader h = {CACHE_MAGIC, o->v->len, o->vn->len, o->vt->len, o->f->len, o->mtl->len, o->files->len};
+  cache_put(f, &h, sizeof(h));
+  for (int i = 0; i < o->files->len; i++) {
+    char *name = *(char**)list_get(o->files, i);
+    CacheFile cf;
+    if (cache_stat(name, &cf) != 0) { fclose(f); remove(tmp); free(tmp); free(path); return; }
+    cache_put(f, &cf, sizeof(cf));
+    cache_put(f, name, cf.len);
   }
-  if (state.shading == SHADING_GOURAUD) {
-    has_normals = f.vn1 > 0 && f.vn2 > 0 && f.vn3 > 0;
-    if (has_normals) {
-      vn1 = vec_nrm(VREF(list_get(obj->vn, f.vn1-1)));
-      vn2 = vec_nrm(VREF(list_get(obj->vn, f.vn2-1)));
-      vn3 = vec_nrm(VREF(list_get(obj->vn, f.vn3-1)));
-      vn1 = perspective(vn1, state.x, state.y, state.z);
-      vn2 = perspective(vn2, state.x, state.y, state.z);
-      vn3 = perspective(vn3, state.x, state.y, state.z);
+  cache_put(f, o->v->x, sizeof(float) * o->v->len);
+  cache_put(f, o->v->y, sizeof(float) * o->v->len);
+  cache_put(f, o->v->z, sizeof(float) * o->v->len);
+  cache_put(f, o->vn->p, sizeof(Vec) * o->vn->len);
+  cache_put(f, o->vt->p, sizeof(Vec) * o->vt->len);
+  cache_put(f, o->f->p, sizeof(Face) * o->f->len);
+  for (int i = 0; i < o->mtl->len; i++) {
+    Mtl *m = (Mtl*)list_get(o->mtl, i);
+    Texture *t = m->texture;
+    CacheMtl cm = {strlen(m->name), t ? t->w : 0, t ? t->h : 0, t ? t->format : -1, t ? t->opaque : 0};
+    cache_put(f, &cm, sizeof(cm));
+    cache_put(f, m->name, cm.len);
+    if (t) {
+      if (tex_colors(t->format)) cache_put(f, t->clut, sizeof(TPixel) * tex_colors(t->format));
+      cache_put(f, t->pix, tex_bytes(t->format, t->w * t->h));
     }
   }
 
-  Vec vt1 = VREF(list_get(obj->vt, f.vt1-1)),
-      vt2 = VREF(list_get(obj->vt, f.vt2-1)),
-      vt3 = VREF(list_get(obj->vt, f.vt3-1));
+  int failed = ferror(f);
+  if (fclose(f) != 0 || failed) { remove(tmp); free(tmp); free(path); return; }
+  remove(path);
+  if (rename(tmp, path) != 0) remove(tmp);
+  free(tmp);
+  free(path);
+}
 
-  int minX = fminf(fminf(sf.v1.x, sf.v2.x), sf.v3.x),
-      maxX = fmaxf(fmaxf(sf.v1.x, sf.v2.x), sf.v3.x)+1,
-      minY = fminf(fminf(sf.v1.y, sf.v2.y), sf.v3.y),
-      maxY = fmaxf(fmaxf(sf.v1.y, sf.v2.y), sf.v3.y)+1;
+static list *cache_list(int size, void *p, int len) {
+  list *l = list_new(size);
+  l->p = p;
+  l->len = l->cap = len;
+  return l;
+}
 
-  for (int y = minY; y < maxY; y++) {
-    for (int x = minX; x < maxX; x++) {
-      Vec p = {x, y, 0};
-      Vec bc = barycenter(p, sf.v1, sf.v2, sf.v3);
-      float err = -0.0001;
-      if (bc.x >= err && bc.y >= err && bc.z >= err) {
-        if (state.use_zbuffer) {
-          float z = bc.x*sf.v1.z + bc.y*sf.v2.z + bc.z*sf.v3.z;
-          int zbuff_idx = y * WIDTH + x;
-          if (z > state.zbuff[zbuff_idx]) continue;
-          state.zbuff[zbuff_idx] = z;
-        }
+// returns NULL if there is no cache or it is stale
+Obj *obj_readcache(const char *filepath) {
+  char *path = cache_path(filepath);
+  mfile *m = mfile_open(path, 1);
+  free(path);
+  if (m == NULL) return NULL;
 
-        float u, v;
-
-        if (state.use_pcorrect) {
-          Vec bcc = bc;
-          bcc.x = bc.x/(sf.v1.z);
-          bcc.y = bc.y/(sf.v2.z);
-          bcc.z = bc.z/(sf.v3.z);
-          float bd = bcc.x+bcc.y+bcc.z;
-          bcc.x = bcc.x/bd;
-          bcc.y = bcc.y/bd;
-          bcc.z = bcc.z/bd;
-
-          u = bcc.x*vt1.x + bcc.y*vt2.x + bcc.z*vt3.x;
-          v = 1.0-(bcc.x*vt1.y + bcc.y*vt2.y + bcc.z*vt3.y);
-        } else {
-          u = bc.x*vt1.x + bc.y*vt2.x + bc.z*vt3.x;
-          v = 1.0-(bc.x*vt1.y + bc.y*vt2.y + bc.z*vt3.y);
-        }
+  char *pos = m->p, *end = m->p + m->len;
+  CacheHeader *h = cache_take(&pos, end, sizeof(CacheHeader));
+  if (h == NULL || memcmp(h->magic, CACHE_MAGIC, 8) != 0 || h->nfiles < 1) goto stale;
 
-        int tx = texture->w * u;
-        int ty = texture->h * v;
+  Obj *o = calloc(1, sizeof(Obj));
+  o->mtl = list_new(sizeof(Mtl));
+  o->files = list_new(sizeof(char*));
+  o->cache = m;
+
+  for (int i = 0; i < h->nfiles; i++) {
+    CacheFile *cf = cache_take(&pos, end, sizeof(CacheFile)), cur;
+    char *name = cf ? cache_take(&pos, end, cf->len) : NULL;
+    if (name == NULL) goto stale_obj;
+    char *file = malloc(cf->len + 1);
+    memcpy(file, name, cf->len);
+    file[cf->len] = '\0';
+    list_add(o->files, &file);
+    if (i == 0 && strcmp(file, filepath) != 0) goto stale_obj;
+    if (cache_stat(file, &cur) != 0 || cur.mtime != cf->mtime || cur.size != cf->size) goto stale_obj;
+  }
 
-        TPixel texel = tigrGet(texture, tx % texture->w, ty % texture->h);
+  float *vx = cache_take(&pos, end, sizeof(float) * h->nv);
+  float *vy = cache_take(&pos, end, sizeof(float) * h->nv);
+  float *vz = cache_take(&pos, end, sizeof(float) * h->nv);
+  Vec *vn = cache_take(&pos, end, sizeof(Vec) * h->nvn);
+  Vec *vt = cache_take(&pos, end, sizeof(Vec) * h->nvt);
+  Face *f = cache_take(&pos, end, sizeof(Face) * h->nf);
+  if (!vx || !vy || !vz || !vn || !vt || !f) goto stale_obj;
+  o->v = calloc(1, sizeof(Vecs));
+  o->v->x = vx; o->v->y = vy; o->v->z = vz;
+  o->v->len = h->nv;
+  o->vn = cache_list(sizeof(Vec), vn, h->nvn);
+  o->vt = cache_list(sizeof(Vec), vt, h->nvt);
+  o->f = cache_list(sizeof(Face), f, h->nf);
+
+  for (int i = 0; i < h->nmtl; i++) {
+    CacheMtl *cm = cache_take(&pos, end, sizeof(CacheMtl));
+    char *name = cm ? cache_take(&pos, end, cm->len) : NULL;
+    if (name == NULL) goto stale_obj;
+    Mtl mtl = {malloc(cm->len + 1), NULL, NULL, NULL};
+    memcpy(mtl.name, name, cm->len);
+    mtl.name[cm->len] = '\0';
+    if (cm->format >= 0) {
+      int colors = tex_colors(cm->format);
+      TPixel *clut = colors ? cache_take(&pos, end, sizeof(TPixel) * colors) : NULL;
+      unsigned char *pix = cache_take(&pos, end, tex_bytes(cm->format, cm->w * cm->h));
+      if (pix != NULL && (clut != NULL || !colors))
+        mtl.texture = tex_wrap(cm->w, cm->h, cm->format, cm->opaque, clut, pix);
+    }
+    list_add(o->mtl, &mtl);
+    if (cm->format >= 0 && mtl.texture == NULL) goto stale_obj;
+  }
+  return o;
 
-        if (state.shading == SHADING_GOURAUD && has_normals) {
-          int s1 = shade(vn1, bc);
-          int s2 = shade(vn2, bc);
-          int s3 = shade(vn3, bc);
-          shading = bc.x*s1 + bc.y*s2 + bc.z*s3;
-        }
+stale_obj:
+  obj_del(o);
+  return NULL;
+stale:
+  mfile_close(m);
+  return NULL;
+}
+
+// loads a normalized model, from its cache when that is up to date
+Obj *obj_load(char *filepath, pool *pool) {
+  double t = now();
+  Obj *obj = obj_readcache(filepath);
+  if (obj != NULL) {
+    printf("loaded %s from cache in %.3fs\n", filepath, now() - t);
+  } else {
+    obj = obj_readfile(filepath, pool);
+    obj_normalize(obj);
+    mtl_textures(obj->mtl);
+    obj_writecache(obj, filepath);
+  }
+  return obj;
+}
+
+// main
+
+// per-frame counters, shown with the stats overlay
+typedef struct {
+  int faces;
+  int drawn;        // faces left after clipping and backface culling
+  int pvs;          // faces in the potentially visible set, 0 without one
+  int transforms;   // vertices run through perspective/project
+  double sort_ms;
+  int sort_kept;    // taken from an order kept for the view direction
+  double raster_ms;
+  int raster_tiles;   // tiles with anything to draw, 0 if not tiled
+  int hz_tris, hz_blocks;  // skipped for the coarse depth
+} Stats;
+
+typedef struct {
+  int draw_wireframe, use_zbuffer, use_pcorrect, inv_bculling, jitter, show_stats;
+  int sort_maxz;      // order by the farthest vertex instead of the average
+  int sort_cached;    // take an order kept for the view direction instead
+  enum { SHADING_NONE = 0, SHADING_FLAT, SHADING_GOURAUD } shading;
+  enum { RASTER_EDGES = 0, RASTER_SPANS } raster;
+  int use_tiles;      // rasterize screen tiles on the pool
+  int use_simd;       // vectorized pixel loop where the cpu has one
+  int use_hz;         // skip blocks behind the coarse depth
+  int use_depth16;    // 16-bit integer z-buffer instead of floats
+  int use_texblocks;  // sample textures laid out in blocks where they have one
+  int use_shadelut;   // quantize shading, looked up for CLUT textures
+  int use_variants;   // pixel loops specialized for the flags above
+  int use_bins;       // skip bins of faces turned away whole
+  int use_pvs;        // only look at faces seen from nearby view directions
+  int pcorrect_step;  // pixels per exact perspective division, a power of two
+  Vec x, y, z;
+  struct Depth *depth;
+  Vecs *view, *proj;  // obj->v after perspective and after project
+  int *shades;        // gouraud intensity of every obj->vn
+  int *drawn;         // sfaces to draw this frame, see draw
+  struct Bins *bins;
+  struct Pvs *pvs;
+  struct Orders *orders;
+  struct Ot *ot;
+  struct Tiles *tiles;
+  pool *pool;
+  Stats *stats;
+} State;
+
+// what is left of a surface crossing a clipping plane, see clip_surface
+#define CLIP_VERTS 8  // a triangle cut by all five planes
+
+typedef struct Clip {
+  Vec v[CLIP_VERTS];  // projected
+  Vec b[CLIP_VERTS];  // weights of the surface's vertices
+  int n;
+} Clip;
+
+enum { CLIP_IN = 0, CLIP_CUT, CLIP_OUT };
+
+typedef struct {
+  Vec v1, v2, v3;
+  Vec vn1, vn2, vn3;
+  Vec nrm;
+  int idx;
+  int clip;   // CLIP_CUT is drawn from cut instead of v1, v2 and v3
+  Clip *cut;  // allocated the first time it is needed
+} Surface;
 
-        if (shading >= 0) {
-          texel.r = (texel.r * shading) >> 8;
-          texel.g = (texel.g * shading) >> 8;
-          texel.b = (texel.b * shading) >> 8;
+// ordering table
+//
+// Painter's order the way the PS1 produces it: surfaces are linked into a
+// fixed number of buckets by quantized depth and drawn bucket by bucket,
+// from the farthest to the nearest. Linear in the number of surfaces.
+// Only the surfaces drawn in a frame are ordered, given as a list of
+// their indices.
+//
+// An order kept for the view direction can be taken instead, see
+// orders_get.
+
+#define OT_SIZE 4096
+
+typedef struct Ot {
+  int head[OT_SIZE];  // first surface of each bucket, -1 if empty
+  int *next;          // next surface in the same bucket
+  float *key;         // depth of each surface
+  int *order;         // surfaces in drawing order
+  int *tag;           // frame a surface was last drawn in
+  int len, n;         // surfaces, and how many of them are in order
+  int frame;
+} Ot;
+
+Ot *ot_new(int len) {
+  Ot *ot = calloc(1, sizeof(Ot));
+  ot->len = len;
+  ot->next = malloc(sizeof(int) * len);
+  ot->key = malloc(sizeof(float) * len);
+  ot->order = malloc(sizeof(int) * len);
+  ot->tag = calloc(len, sizeof(int));
+  return ot;
+}
+
+void ot_del(Ot *ot) {
+  free(ot->next);
+  free(ot->key);
+  free(ot->order);
+  free(ot->tag);
+  free(ot);
+}
+
+static void ot_keys(Ot *ot, list *sfaces, int *drawn, int n, int maxz, float *zmin, float *zmax) {
+  *zmin = FLT_MAX, *zmax = -FLT_MAX;
+  for (int k = 0; k < n; k++) {
+    int i = drawn[k];
+    Surface *sf = (Surface*)list_get(sfaces, i);
+    float z = maxz
+      ? fmaxf(fmaxf(sf->v1.z, sf->v2.z), sf->v3.z)
+      : (sf->v1.z + sf->v2.z + sf->v3.z) / 3;
+    if (sf->clip == CLIP_CUT) {
+      Clip *c = sf->cut;
+      z = maxz ? -FLT_MAX : 0;
+      for (int j = 0; j < c->n; j++) z = maxz ? fmaxf(z, c->v[j].z) : z + c->v[j].z;
+      if (!maxz) z /= c->n;
+    }
+    ot->key[i] = z;
+    *zmin = fminf(*zmin, z);
+    *zmax = fmaxf(*zmax, z);
+  }
+}
+
+// expects the keys to be up to date
+static void ot_build(Ot *ot, int *drawn, int n, float zmin, float zmax) {
+  float scale = zmax > zmin ? (OT_SIZE-1) / (zmax-zmin) : 0;
+  for (int i = 0; i < OT_SIZE; i++) ot->head[i] = -1;
+  for (int k = 0; k < n; k++) {
+    int i = drawn[k];
+    int b = (ot->key[i] - zmin) * scale;
+    b = b < 0 ? 0 : b >= OT_SIZE ? OT_SIZE-1 : b;
+    ot->next[i] = ot->head[b];
+    ot->head[b] = i;
+  }
+
+  ot->n = 0;
+  for (int b = OT_SIZE-1; b >= 0; b--)
+    for (int i = ot->head[b]; i >= 0; i = ot->next[i]) ot->order[ot->n++] = i;
+}
+
+void ot_sort(Ot *ot, list *sfaces, int *drawn, int n, int maxz) {
+  float zmin, zmax;
+  ot_keys(ot, sfaces, drawn, n, maxz, &zmin, &zmax);
+  ot_build(ot, drawn, n, zmin, zmax);
+}
+
+// takes the drawn surfaces in the given order of all len of them, kept
+// for a close view direction, see orders_get. no keys are needed, so it
+// is a single pass over the order.
+void ot_from(Ot *ot, int *drawn, int n, int *order, int len) {
+  ot->frame++;
+  for (int k = 0; k < n; k++) ot->tag[drawn[k]] = ot->frame;
+  ot->n = 0;
+  for (int k = 0; k < len; k++)
+    if (ot->tag[order[k]] == ot->frame) ot->order[ot->n++] = order[k];
+}
+
+static Vec lights = {-1, -1, -1};
+
+int shade(Vec nrm, Vec bc) {
+  Vec var = {vec_dot(lights, nrm), vec_dot(lights, nrm), vec_dot(lights, nrm)};
+  float intensity = vec_dot(bc, var);
+  return 0xFF * fminf(fmaxf(0.3, intensity), 1);
+}
+
+// Gouraud intensity of every normal in vn, which obj_normalize left unit
+// length. Rather than turning each normal into view space, the light is
+// turned into object space once, so a normal costs a single dot product
+// per frame however many faces share it.
+void shade_normals(list *vn, int *shades, Vec x, Vec y, Vec z) {
+  Vec light = {lights.x*x.x + lights.y*y.x + lights.z*z.x,
+               lights.x*x.y + lights.y*y.y + lights.z*z.y,
+               lights.x*x.z + lights.y*y.z + lights.z*z.z};
+  for (int i = 0; i < vn->len; i++)
+    shades[i] = 0xFF * fminf(fmaxf(0.3, vec_dot(light, VREF(list_get(vn, i)))), 1);
+}
+
+void draw_wireframe(Tigr *scr, Surface sf, TPixel color) {
+  if (sf.clip == CLIP_CUT) {
+    Vec *v = sf.cut->v;
+    for (int i = 0, j = sf.cut->n - 1; i < sf.cut->n; j = i++)
+      tigrLine(scr, v[j].x, v[j].y, v[i].x, v[i].y, color);
+    return;
+  }
+  tigrLine(scr, sf.v1.x, sf.v1.y, sf.v2.x, sf.v2.y, color);
+  tigrLine(scr, sf.v2.x, sf.v2.y, sf.v3.x, sf.v3.y, color);
+  tigrLine(scr, sf.v3.x, sf.v3.y, sf.v1.x, sf.v1.y, color);
+}
+
+// rasterization
+//
+// Coverage is decided by the triangle's edge functions in fixed point
+// with SUBPIXEL fractional bits, stepped by integer adds from pixel to
+// pixel. Pixels exactly on an edge only belong to the triangle if it is
+// a top or left edge, so shared edges are drawn once. Depth, texture
+// coordinates and shading are plane equations over the same area, set up
+// once per triangle and stepped along each row.
+
+#define SUBPIXEL 8
+#define RASTER_MAX (1 << 20)  // larger coordinates don't fit the edge math
+
+typedef struct {
+  long long e, dx, dy;  // value at the bounding box origin and steps
+} Edge;
+
+typedef struct {
+  double a, dx, dy;     // value at the bounding box origin and steps
+} Plane;
+
+// depth
+//
+// The z-buffer holds floats or, with use_depth16, 16-bit integers spread
+// over [DEPTH_NEAR, DEPTH_FAR], which halves its memory traffic for some
+// precision. It is cleared lazily: each TILE x TILE tile is tagged with
+// the frame it was last cleared in, and only cleared once something is
+// about to be drawn to it, so untouched tiles are never written.
+//
+// Next to it, every HZ x HZ block keeps the farthest depth it holds.
+// Where the nearest depth a triangle could have in a block is farther
+// than that, none of its pixels there can pass the depth test, so the
+// block is skipped, and the whole triangle if that holds for all of
+// them. A block written to is only recomputed the next time a triangle
+// is tested against it. WIDTH, HEIGHT and TILE are multiples of HZ.
+
+#define TILE 32
+#define TILES_X ((WIDTH + TILE-1) / TILE)
+#define TILES_Y ((HEIGHT + TILE-1) / TILE)
+
+#define DEPTH_NEAR (DISTANCE - 2.5f)  // normalized models project in between
+#define DEPTH_FAR  (DISTANCE + 1.5f)
+#define DEPTH16_SCALE (0xFFFF / (DEPTH_FAR - DEPTH_NEAR))
+
+#define HZ 8
+#define HZ_BLOCKS (WIDTH/HZ * HEIGHT/HZ)
+
+typedef struct Block {
+  float zmax;           // in the units of the z-buffer
+  int dirty;            // written since zmax was computed
+} Block;
+
+typedef struct Depth {
+  float *f32;
+  unsigned short *u16;  // padded for whole vector stores at the end
+  Block *hz;
+  unsigned epoch, tag[TILES_X * TILES_Y];
+} Depth;
+
+Depth *depth_new(void) {
+  Depth *d = calloc(1, sizeof(Depth));
+  d->f32 = malloc(sizeof(float) * WIDTH * HEIGHT);
+  d->u16 = malloc(sizeof(unsigned short) * (WIDTH * HEIGHT + 8));
+  d->hz = malloc(sizeof(Block) * HZ_BLOCKS);
+  return d;
+}
+
+void depth_del(Depth *d) {
+  free(d->f32);
+  free(d->u16);
+  free(d->hz);
+  free(d);
+}
+
+// starts a frame, every tile is considered cleared from here on
+void depth_clear(Depth *d) {
+  d->epoch++;
+}
+
+static int depth16(float z) {
+  return fminf(fmaxf((z - DEPTH_NEAR) * DEPTH16_SCALE, 0), 0xFFFF);
+}
+
+// the part of the screen a triangle may be drawn to, with its depth
+typedef struct {
+  Tigr *scr;
+  float *zbuff;         // depth at (x0, y0), rows are zpitch apart,
+  unsigned short *zbuff16;  // in one of the two formats
+  int zpitch;
+  Block *hz;            // block at (x0, y0), rows are hzpitch apart
+  int hzpitch;
+  int x0, y0, x1, y1;
+  int culled_tris, culled_blocks;
+} Target;
+
+#define TARGET_Z(t, x, y) ((t)->zbuff[((y) - (t)->y0) * (t)->zpitch + (x) - (t)->x0])
+#define TARGET_Z16(t, x, y) ((t)->zbuff16[((y) - (t)->y0) * (t)->zpitch + (x) - (t)->x0])
+#define TARGET_HZ(t, bx, by) ((t)->hz[((by) - (t)->y0/HZ) * (t)->hzpitch + (bx) - (t)->x0/HZ])
+
+// fills rows [y0, y1) of columns [x0, x1) of the target with the far
+// plane and resets their blocks
+static void depth_fill(Target *t, int x0, int y0, int x1, int y1) {
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++) {
+      if (t->zbuff16) TARGET_Z16(t, x, y) = 0xFFFF;
+      else TARGET_Z(t, x, y) = FLT_MAX;
+    }
+  for (int by = y0 / HZ; by < y1 / HZ; by++)
+    for (int bx = x0 / HZ; bx < x1 / HZ; bx++)
+      TARGET_HZ(t, bx, by) = (Block){FLT_MAX, 0};
+}
+
+// clears tile i of a whole-screen target if it wasn't this frame
+void depth_touch(Depth *d, Target *t, int i) {
+  if (d->tag[i] == d->epoch) return;
+  int x0 = i % TILES_X * TILE, y0 = i / TILES_X * TILE;
+  depth_fill(t, x0, y0, x0 + TILE < WIDTH ? x0 + TILE : WIDTH, y0 + TILE < HEIGHT ? y0 + TILE : HEIGHT);
+  d->tag[i] = d->epoch;
+}
+
+// copies the target's part of the whole-screen z-buffer into its own,
+// or back with store
+void depth_copy(Depth *d, Target *t, int store) {
+  int w = t->x1 - t->x0;
+  for (int y = t->y0; y < t->y1; y++) {
+    if (t->zbuff16) {
+      unsigned short *g = &d->u16[y * WIDTH + t->x0], *l = &TARGET_Z16(t, t->x0, y);
+      memcpy(store ? g : l, store ? l : g, w * sizeof(unsigned short));
+    } else {
+      float *g = &d->f32[y * WIDTH + t->x0], *l = &TARGET_Z(t, t->x0, y);
+      memcpy(store ? g : l, store ? l : g, w * sizeof(float));
+    }
+  }
+}
+
+// depth test and write of pixel (x, y) of the target
+static int depth_test(Target *t, int x, int y, float z) {
+  if (t->zbuff16) {
+    unsigned short *zp = &TARGET_Z16(t, x, y), q = depth16(z);
+    if (q > *zp) return 0;
+    *zp = q;
+    return 1;
+  }
+  float *zp = &TARGET_Z(t, x, y);
+  if (z > *zp) return 0;
+  *zp = z;
+  return 1;
+}
+
+// whether anything at least as far as zmin can pass the depth test
+// somewhere in block (bx, by)
+static int hz_test(Target *t, int bx, int by, float zmin) {
+  Block *b = &TARGET_HZ(t, bx, by);
+  if (t->zbuff16) {
+    if (b->dirty) {
+#ifdef HAVE_SSE2
+      // signed 16-bit max with the sign bit flipped is the unsigned one
+      __m128i m = _mm_set1_epi16(-0x8000), flip = _mm_set1_epi16(-0x8000);
+      for (int y = by*HZ; y < by*HZ + HZ; y++)
+        m = _mm_max_epi16(m, _mm_xor_si128(_mm_loadu_si128((__m128i*)&TARGET_Z16(t, bx*HZ, y)), flip));
+      m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+      m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+      m = _mm_max_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+      b->zmax = (unsigned short)(_mm_cvtsi128_si32(m) ^ 0x8000);
+#else
+      int zmax = 0;
+      for (int y = by*HZ; y < by*HZ + HZ; y++)
+        for (int x = bx*HZ; x < bx*HZ + HZ; x++)
+          if (TARGET_Z16(t, x, y) > zmax) zmax = TARGET_Z16(t, x, y);
+      b->zmax = zmax;
+#endif
+      b->dirty = 0;
+    }
+    zmin = depth16(zmin);
+  } else if (b->dirty) {
+    // a NaN depth lets everything through, so the block must be kept
+#ifdef HAVE_SSE2
+    __m128 m = _mm_set1_ps(-FLT_MAX), nan = _mm_setzero_ps();
+    for (int y = by*HZ; y < by*HZ + HZ; y++) {
+      __m128 z0 = _mm_loadu_ps(&TARGET_Z(t, bx*HZ, y)), z1 = _mm_loadu_ps(&TARGET_Z(t, bx*HZ + 4, y));
+      m = _mm_max_ps(m, _mm_max_ps(z0, z1));
+      nan = _mm_or_ps(nan, _mm_or_ps(_mm_cmpunord_ps(z0, z0), _mm_cmpunord_ps(z1, z1)));
+    }
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    b->zmax = _mm_movemask_ps(nan) ? NAN : _mm_cvtss_f32(m);
+#else
+    b->zmax = -FLT_MAX;
+    for (int y = by*HZ; y < by*HZ + HZ; y++)
+      for (int x = bx*HZ; x < bx*HZ + HZ; x++) {
+        float z = TARGET_Z(t, x, y);
+        b->zmax = isnan(z) || isnan(b->zmax) ? NAN : fmaxf(b->zmax, z);
+      }
+#endif
+    b->dirty = 0;
+  }
+  if (!(zmin > b->zmax)) return 1;
+  t->culled_blocks++;
+  return 0;
+}
+
+// moves *x0 to the first pixel of row y in a block that passed hz_test,
+// marks the blocks from there on that passed too as written, and returns
+// where they end, at most x1
+static int hz_run(Target *t, unsigned char keep[][WIDTH/HZ], int y, int *x0, int x1) {
+  int by = y / HZ, x = *x0;
+  while (x < x1 && !keep[by][x / HZ]) x = (x / HZ + 1) * HZ;
+  *x0 = x;
+  while (x < x1 && keep[by][x / HZ]) {
+    TARGET_HZ(t, x / HZ, by).dirty = 1;
+    x = (x / HZ + 1) * HZ;
+  }
+  return x < x1 ? x : x1;
+}
+
+// barycentric weights are the edge values divided by their sum,
+// so any per-vertex attribute is a plane over the edge functions
+static Plane plane(Edge *e, double invd, float a1, float a2, float a3) {
+  Plane p = {
+    (e[0].e * a1 + e[1].e * a2 + e[2].e * a3) * invd,
+    (e[0].dx * a1 + e[1].dx * a2 + e[2].dx * a3) * invd,
+    (e[0].dy * a1 + e[1].dy * a2 + e[2].dy * a3) * invd,
+  };
+  return p;
+}
+
+// sets up the edge functions, positive inside the triangle whatever its
+// winding, and returns their sum (twice the area), 0 if degenerate
+static long long edges(Vec v1, Vec v2, Vec v3, int x0, int y0, Edge *e) {
+  long long X[3] = {llrintf(v1.x * (1 << SUBPIXEL)), llrintf(v2.x * (1 << SUBPIXEL)), llrintf(v3.x * (1 << SUBPIXEL))};
+  long long Y[3] = {llrintf(v1.y * (1 << SUBPIXEL)), llrintf(v2.y * (1 << SUBPIXEL)), llrintf(v3.y * (1 << SUBPIXEL))};
+  long long px = (long long)x0 * (1 << SUBPIXEL), py = (long long)y0 * (1 << SUBPIXEL);
+
+  // edge i is opposite to vertex i, like barycentric weight i
+  for (int i = 0; i < 3; i++) {
+    int a = (i+1) % 3, b = (i+2) % 3;
+    long long A = Y[a] - Y[b], B = X[b] - X[a];
+    e[i].e = A * (px - X[b]) + B * (py - Y[b]);
+    e[i].dx = A * (1 << SUBPIXEL);
+    e[i].dy = B * (1 << SUBPIXEL);
+  }
+
+  long long d = e[0].e + e[1].e + e[2].e;
+  if (d < 0) {
+    for (int i = 0; i < 3; i++) { e[i].e = -e[i].e; e[i].dx = -e[i].dx; e[i].dy = -e[i].dy; }
+  }
+  return d < 0 ? -d : d;
+}
+
+// narrows [*x0, *x1) to the pixels of a row where all edges are >= 0,
+// given the edge values at the first pixel
+static void edges_span(Edge *e, long long *v, int *x0, int *x1) {
+  for (int i = 0; i < 3; i++) {
+    if (e[i].dx > 0) {
+      if (v[i] < 0) { long long k = (-v[i] + e[i].dx-1) / e[i].dx; if (k > *x0) *x0 = k < *x1 ? k : *x1; }
+    } else if (e[i].dx < 0) {
+      long long k = v[i] < 0 ? -1 : v[i] / -e[i].dx;
+      if (k+1 < *x1) *x1 = k+1 > *x0 ? k+1 : *x0;
+    } else if (v[i] < 0) {
+      *x1 = *x0;
+    }
+  }
+}
+
+// pixels exactly on an edge are only covered by top and left edges,
+// biasing the others by one lets the inside test stay e >= 0
+static void edges_topleft(Edge *e) {
+  for (int i = 0; i < 3; i++) {
+    int topleft = e[i].dx > 0 || (e[i].dx == 0 && e[i].dy > 0);
+    if (!topleft) e[i].e -= 1;
+  }
+}
+
+// what a rasterizer needs of a surface besides its screen position
+typedef struct {
+  Sampler tex;
+  Vec vt1, vt2, vt3;
+  int shading, gouraud;  // flat intensity (-1 unlit) or per-vertex ones
+  int s1, s2, s3;
+} Raster;
+
+static int raster_setup(Obj *obj, Surface *sf, State *state, Raster *r) {
+  Face f = *(Face*)(list_get(obj->f, sf->idx));
+
+  Texture *texture = f.mtl >= 0 ? ((Mtl*)list_get(obj->mtl, f.mtl))->texture : NULL;
+  if (texture == NULL) return 0;
+  r->tex = tex_sampler(texture, state->use_texblocks, state->use_shadelut);
+
+  r->shading = -1; r->gouraud = 0;
+  r->s1 = r->s2 = r->s3 = 0;
+
+  if (state->shading == SHADING_FLAT) {
+    Vec bc = {0.333, 0.333, 0.333};
+    r->shading = shade(sf->nrm, bc);
+  }
+  if (state->shading == SHADING_GOURAUD) {
+    r->gouraud = f.vn1 > 0 && f.vn2 > 0 && f.vn3 > 0;
+    if (r->gouraud) {
+      // the light is directional, so shading only varies between vertices
+      r->s1 = state->shades[f.vn1-1];
+      r->s2 = state->shades[f.vn2-1];
+      r->s3 = state->shades[f.vn3-1];
+    }
+  }
+
+  r->vt1 = VREF(list_get(obj->vt, f.vt1-1));
+  r->vt2 = VREF(list_get(obj->vt, f.vt2-1));
+  r->vt3 = VREF(list_get(obj->vt, f.vt3-1));
+  return 1;
+}
+
+// With a pcorrect_step above 1, texture coordinates are divided exactly
+// only every pcorrect_step pixels from the start of the row's coverage
+// and at its last pixel, and stepped affinely in between, like Quake
+// did. The steps are laid out from the coverage rather than from the
+// pixels drawn, so a pixel gets the same value however its row is split.
+typedef struct {
+  int a, b;              // the step covers pixels [a, b), from minX
+  float u, v, udx, vdx;  // texture coordinates at a and per pixel
+} Step;
+
+// one row of a triangle: pixels minX+x0 to minX+x1 (exclusive) of row y,
+// with the attributes at minX and their steps per pixel
+typedef struct {
+  int y, minX, x0, x1;
+  float z, u, v, w, s;
+  float zdx, udx, vdx, wdx, sdx;
+  Step *step;  // with pcorrect_step, the steps from x0 on
+} Span;
+
+// the steps from x0 to x1 of a row covering [c0, c1), n a power of two;
+// each one ends where the next begins, so it is divided there once
+static void pcorrect_steps(Span *sp, int n, int c0, int c1, Step *step) {
+  int a = c0 + ((sp->x0 - c0) & -n);
+  float q = 1 / (sp->w + sp->wdx*a);
+  float u = (sp->u + sp->udx*a) * q, v = (sp->v + sp->vdx*a) * q;
+  for (; a < sp->x1; a += n) {
+    int e = a + n < c1 ? a + n : c1 - 1;
+    Step st = {a, a + n, u, v, 0, 0};
+    if (e > a) {
+      float d = 1.0f / (e - a);
+      q = 1 / (sp->w + sp->wdx*e);
+      u = (sp->u + sp->udx*e) * q; v = (sp->v + sp->vdx*e) * q;
+      st.udx = (u - st.u) * d; st.vdx = (v - st.v) * d;
+    }
+    *step++ = st;
+  }
+}
+
+// whether tigrPlot would draw every pixel of the target
+static int target_unclipped(Target *t) {
+  Tigr *scr = t->scr;
+  int cw = scr->cw >= 0 ? scr->cw : scr->w, ch = scr->ch >= 0 ? scr->ch : scr->h;
+  return t->x0 >= scr->cx && t->y0 >= scr->cy && t->x1 <= scr->cx + cw && t->y1 <= scr->cy + ch &&
+         t->x1 <= scr->w && t->y1 <= scr->h;
+}
+
+// tigrPlot for a pixel it would not clip: opaque texels, most of them in
+// most textures, are stored as they are, only translucent ones blended
+INLINE void target_plot(Tigr *scr, int x, int y, TPixel p) {
+  TPixel *d = &scr->pix[y * scr->w + x];
+  if (p.a == 0xFF) {
+    if (scr->blitMode == TIGR_KEEP_ALPHA) p.a = d->a;
+    *d = p;
+  } else if (p.a) {
+    tigrPlot(scr, x, y, p);
+  }
+}
+
+// The pixel loop, for a given depth test (zbuffer), perspective
+// (SPAN_AFFINE, SPAN_EXACT or SPAN_STEPPED) and shading (SPAN_UNLIT,
+// SPAN_FLAT or SPAN_GOURAUD). It is only ever called with constants for
+// these, which leaves a copy of the loop without their branches for
+// every combination, see span_variants. Pixels are written with
+// target_plot when direct, which the variants need the target to allow.
+enum { SPAN_AFFINE = 0, SPAN_EXACT, SPAN_STEPPED };
+enum { SPAN_UNLIT = 0, SPAN_FLAT, SPAN_GOURAUD };
+
+INLINE void span_scalar(Target *t, Raster *r, Span *sp, int zbuffer, int pcorrect, int lighting, int direct) {
+  int shading = lighting == SPAN_FLAT ? r->shading : -1, y = sp->y;
+  Step *st = sp->step;
+
+  for (int dx = sp->x0; dx < sp->x1; dx++) {
+    int x = sp->minX + dx;
+    float z = sp->z + sp->zdx*dx;
+    if (zbuffer && !depth_test(t, x, y, z)) continue;
+
+    float u = sp->u + sp->udx*dx, v = sp->v + sp->vdx*dx;
+
+    float tu = u, tv = v;
+    if (pcorrect == SPAN_STEPPED) {
+      while (st->b <= dx) st++;
+      tu = st->u + st->udx*(dx - st->a); tv = st->v + st->vdx*(dx - st->a);
+    } else if (pcorrect == SPAN_EXACT) {
+      float w = sp->w + sp->wdx*dx;
+      tu = u / w; tv = v / w;
+    }
+
+    int tx = r->tex.w * tu;
+    int ty = r->tex.h * (1.0f - tv);
+
+    if (lighting == SPAN_GOURAUD) shading = sp->s + sp->sdx*dx;
+    TPixel texel = tex_fetch(&r->tex, tx, ty, shading);
+    if (direct) target_plot(t->scr, x, y, texel); else tigrPlot(t->scr, x, y, texel);
+  }
+}
+
+typedef void SpanFn(Target *t, State *state, Raster *r, Span *sp);
+
+static int span_pcorrect(State *state) {
+  return !state->use_pcorrect ? SPAN_AFFINE : state->pcorrect_step > 1 ? SPAN_STEPPED : SPAN_EXACT;
+}
+
+static int span_lighting(Raster *r) {
+  return r->gouraud ? SPAN_GOURAUD : r->shading >= 0 ? SPAN_FLAT : SPAN_UNLIT;
+}
+
+// the same loop with every flag checked as it goes, for comparison
+static void span_generic(Target *t, State *state, Raster *r, Span *sp) {
+  span_scalar(t, r, sp, state->use_zbuffer, span_pcorrect(state), span_lighting(r), target_unclipped(t));
+}
+
+#define SPAN_VARIANT(z, p, l) \
+  static void span_##z##p##l(Target *t, State *state, Raster *r, Span *sp) { \
+    (void)state; span_scalar(t, r, sp, z, p, l, 1); \
+  }
+#define SPAN_VARIANTS(z, p) SPAN_VARIANT(z, p, 0) SPAN_VARIANT(z, p, 1) SPAN_VARIANT(z, p, 2)
+SPAN_VARIANTS(0, 0) SPAN_VARIANTS(0, 1) SPAN_VARIANTS(0, 2)
+SPAN_VARIANTS(1, 0) SPAN_VARIANTS(1, 1) SPAN_VARIANTS(1, 2)
+
+// indexed by zbuffer, perspective and shading
+#define SPAN_ROW(z, p) {span_##z##p##0, span_##z##p##1, span_##z##p##2}
+static SpanFn *span_variants[2][3][3] = {
+  {SPAN_ROW(0, 0), SPAN_ROW(0, 1), SPAN_ROW(0, 2)},
+  {SPAN_ROW(1, 0), SPAN_ROW(1, 1), SPAN_ROW(1, 2)},
+};
+
+// the pixel loop for a triangle
+static SpanFn *span_pick(Target *t, State *state, Raster *r) {
+  if (!state->use_variants || !target_unclipped(t)) return span_generic;
+  return span_variants[state->use_zbuffer != 0][span_pcorrect(state)][span_lighting(r)];
+}
+
+#ifdef HAVE_AVX2
+// a % n per lane, rounding toward zero like C, for |a| < 2^22 where the
+// float quotient is off by at most one
+TARGET_AVX2 static __m256i mod_avx2(__m256i a, __m256i n, __m256 nf) {
+  __m256i q = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a), nf));
+  __m256i m = _mm256_sub_epi32(a, _mm256_mullo_epi32(q, n));
+  __m256i neg = _mm256_cmpgt_epi32(_mm256_setzero_si256(), a);
+  __m256i over = _mm256_andnot_si256(neg, _mm256_cmpgt_epi32(m, _mm256_sub_epi32(n, _mm256_set1_epi32(1))));
+  __m256i under = _mm256_andnot_si256(neg, _mm256_cmpgt_epi32(_mm256_setzero_si256(), m));
+  m = _mm256_sub_epi32(m, _mm256_and_si256(over, n));
+  m = _mm256_add_epi32(m, _mm256_and_si256(under, n));
+  over = _mm256_and_si256(neg, _mm256_cmpgt_epi32(m, _mm256_setzero_si256()));
+  under = _mm256_and_si256(neg, _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_set1_epi32(1), n), m));
+  m = _mm256_sub_epi32(m, _mm256_and_si256(over, n));
+  return _mm256_add_epi32(m, _mm256_and_si256(under, n));
+}
+
+// channel c of packed pixels
+#define CHANNEL(p, c) _mm256_and_si256(_mm256_srli_epi32(p, 8*(c)), _mm256_set1_epi32(0xFF))
+
+// span_scalar eight pixels at a time, with the same results: lanes past
+// the end or failing the depth test are masked off, texels are gathered
+// and shaded and blended exactly like tex_fetch and tigrPlot would.
+// The target must be inside the screen's clip rectangle.
+TARGET_AVX2 static void span_avx2(Target *t, State *state, Raster *r, Span *sp) {
+  Sampler *tex = &r->tex;
+  TPixel *row = t->scr->pix + sp->y * t->scr->w + sp->minX;
+  const __m256i ilane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 lane = _mm256_cvtepi32_ps(ilane), one = _mm256_set1_ps(1);
+  const __m256 tw = _mm256_set1_ps(tex->w), th = _mm256_set1_ps(tex->h);
+  const __m256i iw = _mm256_set1_epi32(tex->w), ih = _mm256_set1_epi32(tex->h);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m128i bshift = _mm_cvtsi32_si128(tex->bshift);
+  const __m256i zero = _mm256_setzero_si256(), high = _mm256_set1_epi32(-(1 << 22));
+  const __m256i blend = _mm256_set1_epi32(t->scr->blitMode);
+  int n = state->pcorrect_step;
+  Step *step = sp->step;
+
+  for (int dx = sp->x0; dx < sp->x1; dx += 8) {
+    __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32(sp->x1 - dx), ilane);
+    __m256 fdx = _mm256_add_ps(_mm256_set1_ps(dx), lane);
+
+    __m256 z = _mm256_add_ps(_mm256_set1_ps(sp->z), _mm256_mul_ps(_mm256_set1_ps(sp->zdx), fdx));
+    if (state->use_zbuffer && t->zbuff16) {
+      // depth16, then the whole 8 values are written back
+      unsigned short *zp = &TARGET_Z16(t, sp->minX + dx, sp->y);
+      __m256i zb = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)zp));
+      __m256 f = _mm256_mul_ps(_mm256_sub_ps(z, _mm256_set1_ps(DEPTH_NEAR)), _mm256_set1_ps(DEPTH16_SCALE));
+      __m256i q = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(0xFFFF)));
+      live = _mm256_andnot_si256(_mm256_cmpgt_epi32(q, zb), live);
+      __m256i packed = _mm256_packus_epi32(_mm256_blendv_epi8(zb, q, live), zero);
+      _mm_storeu_si128((__m128i*)zp, _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08)));
+      if (_mm256_testz_si256(live, live)) continue;
+    } else if (state->use_zbuffer) {
+      float *zp = &TARGET_Z(t, sp->minX + dx, sp->y);
+      __m256 zb = _mm256_maskload_ps(zp, live);
+      live = _mm256_and_si256(live, _mm256_castps_si256(_mm256_cmp_ps(z, zb, _CMP_NGT_UQ)));
+      _mm256_maskstore_ps(zp, live, z);
+      if (_mm256_testz_si256(live, live)) continue;
+    }
+
+    __m256 u = _mm256_add_ps(_mm256_set1_ps(sp->u), _mm256_mul_ps(_mm256_set1_ps(sp->udx), fdx));
+    __m256 v = _mm256_add_ps(_mm256_set1_ps(sp->v), _mm256_mul_ps(_mm256_set1_ps(sp->vdx), fdx));
+    if (state->use_pcorrect && n > 1) {
+      // each lane takes the step it falls in, eight pixels span a few
+      __m256i ix = _mm256_add_epi32(_mm256_set1_epi32(dx), ilane), sa = zero;
+      __m256 su = _mm256_setzero_ps(), sv = su, sudx = su, svdx = su;
+      while (step->b <= dx) step++;
+      Step *last = step;
+      while (last->b < dx + 8 && last->b < sp->x1) last++;
+      for (Step *st = step; st <= last; st++) {
+        __m256 in = _mm256_castsi256_ps(_mm256_andnot_si256(
+          _mm256_cmpgt_epi32(_mm256_set1_epi32(st->a), ix), _mm256_cmpgt_epi32(_mm256_set1_epi32(st->b), ix)));
+        sa = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(sa), _mm256_castsi256_ps(_mm256_set1_epi32(st->a)), in));
+        su = _mm256_blendv_ps(su, _mm256_set1_ps(st->u), in);
+        sv = _mm256_blendv_ps(sv, _mm256_set1_ps(st->v), in);
+        sudx = _mm256_blendv_ps(sudx, _mm256_set1_ps(st->udx), in);
+        svdx = _mm256_blendv_ps(svdx, _mm256_set1_ps(st->vdx), in);
+      }
+      __m256 da = _mm256_cvtepi32_ps(_mm256_sub_epi32(ix, sa));
+      u = _mm256_add_ps(su, _mm256_mul_ps(sudx, da));
+      v = _mm256_add_ps(sv, _mm256_mul_ps(svdx, da));
+    } else if (state->use_pcorrect) {
+      __m256 w = _mm256_add_ps(_mm256_set1_ps(sp->w), _mm256_mul_ps(_mm256_set1_ps(sp->wdx), fdx));
+      u = _mm256_div_ps(u, w);
+      v = _mm256_div_ps(v, w);
+    }
+
+    __m256i tx = _mm256_cvttps_epi32(_mm256_mul_ps(tw, u));
+    __m256i ty = _mm256_cvttps_epi32(_mm256_mul_ps(th, _mm256_sub_ps(one, v)));
+    if (tex->wmask >= 0 && tex->hmask >= 0) {
+      tx = _mm256_and_si256(tx, _mm256_set1_epi32(tex->wmask));
+      ty = _mm256_and_si256(ty, _mm256_set1_epi32(tex->hmask));
+    } else {
+      __m256i far = _mm256_and_si256(live, _mm256_or_si256(_mm256_abs_epi32(tx), _mm256_abs_epi32(ty)));
+      if (_mm256_testz_si256(far, high)) {
+        tx = mod_avx2(tx, iw, tw);
+        ty = mod_avx2(ty, ih, th);
+      } else {
+        int ax[8], ay[8];
+        _mm256_storeu_si256((__m256i*)ax, tx);
+        _mm256_storeu_si256((__m256i*)ay, ty);
+        for (int i = 0; i < 8; i++) { ax[i] %= tex->w; ay[i] %= tex->h; }
+        tx = _mm256_loadu_si256((__m256i*)ax);
+        ty = _mm256_loadu_si256((__m256i*)ay);
+      }
+      tx = _mm256_add_epi32(tx, _mm256_and_si256(_mm256_cmpgt_epi32(zero, tx), iw));
+      ty = _mm256_add_epi32(ty, _mm256_and_si256(_mm256_cmpgt_epi32(zero, ty), ih));
+    }
+
+    __m256i idx;
+    if (tex->blocked) {
+      __m256i block = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srai_epi32(ty, 2), bshift), _mm256_srai_epi32(tx, 2));
+      __m256i in = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(ty, three), 2), _mm256_and_si256(tx, three));
+      idx = _mm256_add_epi32(_mm256_slli_epi32(block, 4), in);
+    } else {
+      idx = _mm256_add_epi32(_mm256_mullo_epi32(ty, iw), tx);
+    }
+    __m256i shading = _mm256_set1_epi32(r->shading);
+    if (r->gouraud) {
+      __m256 s = _mm256_add_ps(_mm256_set1_ps(sp->s), _mm256_mul_ps(_mm256_set1_ps(sp->sdx), fdx));
+      shading = _mm256_cvttps_epi32(s);
+    }
+    __m256i lit = _mm256_cmpgt_epi32(shading, _mm256_set1_epi32(-1)), level = zero;
+    if (tex->quantize) {
+      level = _mm256_srai_epi32(_mm256_mullo_epi32(shading, _mm256_set1_epi32(SHADE_LEVELS)), 8);
+      level = _mm256_min_epi32(level, _mm256_set1_epi32(SHADE_LEVELS - 1));
+      shading = _mm256_add_epi32(_mm256_mullo_epi32(level, _mm256_set1_epi32(256 / SHADE_LEVELS)),
+                                 _mm256_set1_epi32(128 / SHADE_LEVELS));
+    }
+
+    // CLUT texels come out of the shaded CLUTs, when there are some, with
+    // only the unlit lanes left to the plain CLUT
+    __m256i texel, c, byte = _mm256_set1_epi32(0xFF), five = _mm256_set1_epi32(31);
+    int looked = tex->quantize && tex->lit;
+    switch (tex->format) {
+      case TEX_CLUT4:
+        c = _mm256_mask_i32gather_epi32(zero, (const int*)tex->pix, _mm256_srli_epi32(idx, 1), live, 1);
+        c = _mm256_srlv_epi32(c, _mm256_slli_epi32(_mm256_and_si256(idx, _mm256_set1_epi32(1)), 2));
+        c = _mm256_and_si256(c, _mm256_set1_epi32(15));
+        if (looked) {
+          texel = _mm256_mask_i32gather_epi32(zero, (const int*)tex->lit,
+            _mm256_or_si256(_mm256_slli_epi32(level, 4), c), _mm256_and_si256(live, lit), 4);
+          if (!_mm256_testc_si256(lit, live))
+            texel = _mm256_mask_i32gather_epi32(texel, (const int*)tex->clut, c, _mm256_andnot_si256(lit, live), 4);
+          break;
+        }
+        texel = _mm256_mask_i32gather_epi32(zero, (const int*)tex->clut, c, live, 4);
+        break;
+      case TEX_CLUT8:
+        c = _mm256_mask_i32gather_epi32(zero, (const int*)tex->pix, idx, live, 1);
+        c = _mm256_and_si256(c, byte);
+        if (looked) {
+          texel = _mm256_mask_i32gather_epi32(zero, (const int*)tex->lit,
+            _mm256_or_si256(_mm256_slli_epi32(level, 8), c), _mm256_and_si256(live, lit), 4);
+          if (!_mm256_testc_si256(lit, live))
+            texel = _mm256_mask_i32gather_epi32(texel, (const int*)tex->clut, c, _mm256_andnot_si256(lit, live), 4);
+          break;
+        }
+        texel = _mm256_mask_i32gather_epi32(zero, (const int*)tex->clut, c, live, 4);
+        break;
+      case TEX_RGB555:
+        // each 5-bit channel c becomes c << 3 | c >> 2, as in rgb555
+        c = _mm256_mask_i32gather_epi32(zero, (const int*)tex->pix, idx, live, 2);
+        texel = _mm256_and_si256(_mm256_srai_epi32(_mm256_slli_epi32(c, 16), 31), _mm256_set1_epi32(0xFF000000));
+        for (int ch = 0; ch < 3; ch++) {
+          __m256i v = _mm256_and_si256(_mm256_srli_epi32(c, 5*ch), five);
+          v = _mm256_or_si256(_mm256_slli_epi32(v, 3), _mm256_srli_epi32(v, 2));
+          texel = _mm256_or_si256(texel, _mm256_slli_epi32(v, 8*ch));
         }
-        tigrPlot(scr, x, y, texel);
+        break;
+      default:
+        texel = _mm256_mask_i32gather_epi32(zero, (const int*)tex->pix, idx, live, 4);
+    }
+    looked &= tex->format == TEX_CLUT4 || tex->format == TEX_CLUT8;
+
+    if (!looked && !_mm256_testz_si256(lit, lit)) {
+      __m256i shaded = _mm256_and_si256(texel, _mm256_set1_epi32(0xFF000000));
+      for (int c = 0; c < 3; c++) {
+        __m256i ch = _mm256_srai_epi32(_mm256_mullo_epi32(CHANNEL(texel, c), shading), 8);
+        ch = _mm256_and_si256(ch, _mm256_set1_epi32(0xFF));
+        shaded = _mm256_or_si256(shaded, _mm256_slli_epi32(ch, 8*c));
       }
+      texel = _mm256_blendv_epi8(texel, shaded, lit);
+    }
+
+    // as target_plot: transparent texels are skipped, opaque ones stored
+    __m256i a = _mm256_srli_epi32(texel, 24);
+    live = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, zero), live);
+    __m256i opaque = _mm256_cmpeq_epi32(a, _mm256_set1_epi32(0xFF));
+    if (t->scr->blitMode == TIGR_BLEND_ALPHA && _mm256_testc_si256(opaque, live)) {
+      _mm256_maskstore_epi32((int*)(row + dx), live, texel);
+      continue;
     }
+
+    // and the others blended like tigrPlot: dst += (src - dst) * a^2 >> 16
+    // per channel, a expanded to 0..256
+    __m256i dst = _mm256_maskload_epi32((const int*)(row + dx), live);
+    a = _mm256_sub_epi32(a, _mm256_cmpgt_epi32(a, zero));
+    a = _mm256_mullo_epi32(a, a);
+    __m256i out = zero;
+    for (int c = 0; c < 4; c++) {
+      __m256i d = CHANNEL(dst, c);
+      __m256i k = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(CHANNEL(texel, c), d), a), 16);
+      k = _mm256_and_si256(k, _mm256_set1_epi32(0xFF));
+      if (c == 3) k = _mm256_mullo_epi32(k, blend);
+      d = _mm256_and_si256(_mm256_add_epi32(d, k), _mm256_set1_epi32(0xFF));
+      out = _mm256_or_si256(out, _mm256_slli_epi32(d, 8*c));
+    }
+    _mm256_maskstore_epi32((int*)(row + dx), live, out);
   }
 }
+#endif
 
-void draw(Tigr *scr, Obj *obj, State state, list *sfaces) {
+static void raster_edges(Target *t, Surface *sf, State *state, Raster *r) {
+  Vec vt1 = r->vt1, vt2 = r->vt2, vt3 = r->vt3;
+
+  int minX = fminf(fminf(sf->v1.x, sf->v2.x), sf->v3.x),
+      maxX = fmaxf(fmaxf(sf->v1.x, sf->v2.x), sf->v3.x)+1,
+      minY = fminf(fminf(sf->v1.y, sf->v2.y), sf->v3.y),
+      maxY = fmaxf(fmaxf(sf->v1.y, sf->v2.y), sf->v3.y)+1;
+  if (!(fmaxf(fabsf(sf->v1.x), fabsf(sf->v1.y)) < RASTER_MAX &&
+        fmaxf(fabsf(sf->v2.x), fabsf(sf->v2.y)) < RASTER_MAX &&
+        fmaxf(fabsf(sf->v3.x), fabsf(sf->v3.y)) < RASTER_MAX)) return;
+
+  Edge e[3];
+  long long d = edges(sf->v1, sf->v2, sf->v3, minX, minY, e);
+  if (d == 0) return;
+  double invd = 1.0 / d;
+
+  Plane pz = plane(e, invd, sf->v1.z, sf->v2.z, sf->v3.z);
+  Plane pu, pv, pw;
+  if (state->use_pcorrect) {
+    // u/z, v/z and 1/z are linear in screen space
+    pu = plane(e, invd, vt1.x/sf->v1.z, vt2.x/sf->v2.z, vt3.x/sf->v3.z);
+    pv = plane(e, invd, vt1.y/sf->v1.z, vt2.y/sf->v2.z, vt3.y/sf->v3.z);
+    pw = plane(e, invd, 1/sf->v1.z, 1/sf->v2.z, 1/sf->v3.z);
+  } else {
+    pu = plane(e, invd, vt1.x, vt2.x, vt3.x);
+    pv = plane(e, invd, vt1.y, vt2.y, vt3.y);
+    pw = plane(e, invd, 1, 1, 1);
+  }
+  Plane ps = plane(e, invd, r->s1, r->s2, r->s3);
+  edges_topleft(e);
+
+  // the planes stay relative to the bounding box, only the loops are
+  // clipped, so every pixel gets the same values whatever the target
+  float zdx = pz.dx, udx = pu.dx, vdx = pv.dx, wdx = pw.dx, sdx = ps.dx;
+  int y0 = minY > t->y0 ? minY : t->y0, y1 = maxY < t->y1 ? maxY : t->y1,
+      bx0 = minX > t->x0 ? minX : t->x0, bx1 = maxX < t->x1 ? maxX : t->x1;
+  if (y0 >= y1 || bx0 >= bx1) return;
+  SpanFn *span = span_pick(t, state, r);
+  int simd = 0;
+#ifdef HAVE_AVX2
+  simd = state->use_simd && has_avx2() && target_unclipped(t);
+#endif
+
+  // depth only grows away from one corner of the box, and is rounded the
+  // same way there as in span_scalar, so that is the nearest it gets
+  unsigned char keep[HEIGHT/HZ][WIDTH/HZ];
+  int hz = state->use_zbuffer && state->use_hz;
+  if (hz) {
+    int any = 0;
+    for (int by = y0 / HZ; by <= (y1-1) / HZ; by++) {
+      int cy = pz.dy >= 0 ? (by*HZ > y0 ? by*HZ : y0) : (by*HZ + HZ < y1 ? by*HZ + HZ : y1) - 1;
+      float zy = pz.a + pz.dy*(cy - minY);
+      for (int bx = bx0 / HZ; bx <= (bx1-1) / HZ; bx++) {
+        int cx = zdx >= 0 ? (bx*HZ > bx0 ? bx*HZ : bx0) : (bx*HZ + HZ < bx1 ? bx*HZ + HZ : bx1) - 1;
+        any |= keep[by][bx] = hz_test(t, bx, by, zy + zdx*(cx - minX));
+      }
+    }
+    if (!any) { t->culled_tris++; return; }
+  }
+
+  Step step[WIDTH/2 + 1];
+  for (int y = y0; y < y1; y++) {
+    // only the covered part of the row is visited
+    int dy = y - minY, x0 = t->x0 - minX, x1 = t->x1 - minX;
+    if (x0 < 0) x0 = 0;
+    if (x1 > maxX - minX) x1 = maxX - minX;
+    if (x0 >= x1) continue;
+    long long ev[3] = {e[0].e + e[0].dy*dy, e[1].e + e[1].dy*dy, e[2].e + e[2].dy*dy};
+    edges_span(e, ev, &x0, &x1);
+    if (x0 >= x1) continue;
+
+    Span sp = {y, minX, x0, x1, pz.a + pz.dy*dy, pu.a + pu.dy*dy, pv.a + pv.dy*dy,
+               pw.a + pw.dy*dy, ps.a + ps.dy*dy, zdx, udx, vdx, wdx, sdx, step};
+    if (state->use_pcorrect && state->pcorrect_step > 1) {
+      int c0 = 0, c1 = maxX - minX;
+      edges_span(e, ev, &c0, &c1);
+      pcorrect_steps(&sp, state->pcorrect_step, c0, c1, step);
+    }
+    for (int a = minX + x0, b; a < minX + x1; a = b) {
+      b = hz ? hz_run(t, keep, y, &a, minX + x1) : minX + x1;
+      if (a >= b) break;
+      sp.x0 = a - minX; sp.x1 = b - minX;
+#ifdef HAVE_AVX2
+      if (simd) { span_avx2(t, state, r, &sp); continue; }
+#endif
+      span(t, state, r, &sp);
+    }
+  }
+}
+
+// scanline spans
+//
+// The way the PS1 GPU fills a triangle: vertices are snapped to 16.16
+// fixed point, the left and right edges are walked down one scanline at
+// a time with a constant x step, and each span is filled left to right
+// stepping texture coordinates, depth and shading by constant per-pixel
+// deltas. Texture mapping is always affine and wraps around. A span
+// covers [ceil(left), ceil(right)) on rows [ceil(top), ceil(bottom)),
+// the same top-left rule the edge functions use.
+
+#define FIX 16
+#define SPAN_MAX (1 << 14)  // larger coordinates overflow 16.16
+
+typedef struct {
+  long long x, dx;  // x at the current row and its step per row, 16.16
+} Walk;
+
+static long long fix_ceil(long long a) {
+  return (a + (1 << FIX) - 1) >> FIX;
+}
+
+// edge from (xa, ya) down to (xb, yb), positioned at row y
+static Walk walk(long long xa, long long ya, long long xb, long long yb, int y) {
+  Walk w;
+  w.dx = (xb - xa) * (1 << FIX) / (yb - ya);
+  w.x = xa + (((long long)y * (1 << FIX) - ya) * w.dx >> FIX);
+  return w;
+}
+
+static void raster_spans(Target *t, Surface *sf, State *state, Raster *r) {
+  Vec p[3] = {sf->v1, sf->v2, sf->v3};
+  Vec vt[3] = {r->vt1, r->vt2, r->vt3};
+  int s[3] = {r->s1, r->s2, r->s3};
+
+  for (int i = 0; i < 3; i++)
+    if (!(fabsf(p[i].x) < SPAN_MAX && fabsf(p[i].y) < SPAN_MAX)) return;
+
+  // vertices from top to bottom
+  int o[3] = {0, 1, 2}, tmp;
+  if (p[o[1]].y < p[o[0]].y) { tmp = o[0]; o[0] = o[1]; o[1] = tmp; }
+  if (p[o[2]].y < p[o[1]].y) { tmp = o[1]; o[1] = o[2]; o[2] = tmp; }
+  if (p[o[1]].y < p[o[0]].y) { tmp = o[0]; o[0] = o[1]; o[1] = tmp; }
+
+  long long X[3], Y[3];
+  double a[3][4];  // u and v in texels, depth, intensity
+  for (int i = 0; i < 3; i++) {
+    Vec v = p[o[i]];
+    X[i] = llrintf(v.x * (1 << FIX));
+    Y[i] = llrintf(v.y * (1 << FIX));
+    a[i][0] = vt[o[i]].x * r->tex.w;
+    a[i][1] = (1 - vt[o[i]].y) * r->tex.h;
+    a[i][2] = v.z;
+    a[i][3] = s[o[i]];
+  }
+
+  long long d = (X[1]-X[0]) * (Y[2]-Y[0]) - (X[2]-X[0]) * (Y[1]-Y[0]);
+  int y0 = fix_ceil(Y[0]), y1 = fix_ceil(Y[1]), y2 = fix_ceil(Y[2]);
+  if (d == 0 || y0 >= y2) return;
+
+  // attribute deltas per pixel and row, and values at the top vertex's pixel
+  int ox = X[0] >> FIX, oy = Y[0] >> FIX;
+  long long A[4], DX[4], DY[4];
+  for (int k = 0; k < 4; k++) {
+    double da1 = a[1][k] - a[0][k], da2 = a[2][k] - a[0][k];
+    double gx = (da1 * (Y[2]-Y[0]) - da2 * (Y[1]-Y[0])) / d * (1 << FIX);
+    double gy = (da2 * (X[1]-X[0]) - da1 * (X[2]-X[0])) / d * (1 << FIX);
+    double a0 = a[0][k] + gx * (ox - X[0] / 65536.0) + gy * (oy - Y[0] / 65536.0);
+    A[k] = llrint(a0 * (1 << FIX));
+    DX[k] = llrint(gx * (1 << FIX));
+    DY[k] = llrint(gy * (1 << FIX));
+  }
+
+  // integer depth only grows away from one corner of the box, see raster_edges
+  unsigned char keep[HEIGHT/HZ][WIDTH/HZ];
+  int hz = state->use_zbuffer && state->use_hz;
+  if (hz) {
+    long long xmin = X[0] < X[1] ? X[0] : X[1], xmax = X[0] > X[1] ? X[0] : X[1];
+    xmin = xmin < X[2] ? xmin : X[2]; xmax = xmax > X[2] ? xmax : X[2];
+    // one pixel of slack for the rounding of the edge walks
+    int bx0 = fix_ceil(xmin) - 1, bx1 = fix_ceil(xmax) + 1, by0 = y0, by1 = y2;
+    if (bx0 < t->x0) bx0 = t->x0;
+    if (bx1 > t->x1) bx1 = t->x1;
+    if (by0 < t->y0) by0 = t->y0;
+    if (by1 > t->y1) by1 = t->y1;
+    if (bx0 >= bx1 || by0 >= by1) return;
+
+    int any = 0;
+    for (int by = by0 / HZ; by <= (by1-1) / HZ; by++) {
+      int cy = DY[2] >= 0 ? (by*HZ > by0 ? by*HZ : by0) : (by*HZ + HZ < by1 ? by*HZ + HZ : by1) - 1;
+      for (int bx = bx0 / HZ; bx <= (bx1-1) / HZ; bx++) {
+        int cx = DX[2] >= 0 ? (bx*HZ > bx0 ? bx*HZ : bx0) : (bx*HZ + HZ < bx1 ? bx*HZ + HZ : bx1) - 1;
+        long long z = A[2] + DX[2]*(cx-ox) + DY[2]*(cy-oy);
+        any |= keep[by][bx] = hz_test(t, bx, by, z * (1.0f / (1 << FIX)));
+      }
+    }
+    if (!any) { t->culled_tris++; return; }
+  }
+
+  // only the rows of the target are walked, stepping an edge from the
+  // row it is positioned at gives the same x as positioning it there
+  int direct = target_unclipped(t);
+  int left = d > 0;  // the long edge from top to bottom is the left one
+  int ys = y0 > t->y0 ? y0 : t->y0, ye = y2 < t->y1 ? y2 : t->y1;
+  Walk lw = walk(X[0], Y[0], X[2], Y[2], ys), sw;
+
+  for (int y = ys; y < ye; y++, lw.x += lw.dx, sw.x += sw.dx) {
+    if (y == ys && y < y1) sw = walk(X[0], Y[0], X[1], Y[1], y);
+    if ((y == ys && y > y1) || y == y1) sw = walk(X[1], Y[1], X[2], Y[2], y);
+
+    int x0 = fix_ceil(left ? lw.x : sw.x), x1 = fix_ceil(left ? sw.x : lw.x);
+    if (x0 < t->x0) x0 = t->x0;
+    if (x1 > t->x1) x1 = t->x1;
+    if (x0 >= x1) continue;
+
+    for (int a = x0, b; a < x1; a = b) {
+      b = hz ? hz_run(t, keep, y, &a, x1) : x1;
+      if (a >= b) break;
+
+      long long u = A[0] + DX[0]*(a-ox) + DY[0]*(y-oy),
+                v = A[1] + DX[1]*(a-ox) + DY[1]*(y-oy),
+                z = A[2] + DX[2]*(a-ox) + DY[2]*(y-oy),
+                i = A[3] + DX[3]*(a-ox) + DY[3]*(y-oy);
+
+      for (int x = a; x < b; x++, u += DX[0], v += DX[1], z += DX[2], i += DX[3]) {
+        if (state->use_zbuffer && !depth_test(t, x, y, z * (1.0f / (1 << FIX)))) continue;
+
+        int shading = r->gouraud ? (int)(i >> FIX) : r->shading;
+        TPixel texel = tex_fetch(&r->tex, u >> FIX, v >> FIX, shading);
+        if (direct) target_plot(t->scr, x, y, texel); else tigrPlot(t->scr, x, y, texel);
+      }
+    }
+  }
+}
+
+// clipping
+//
+// Surfaces are clipped in view space, before they are projected, by the
+// near plane and by the four sides of a guard band around the screen.
+// Anything within the band is left to the rasterizers, which only visit
+// the rows and pixels of their target, so nothing is ever clipped to the
+// screen itself and most surfaces crossing its border are drawn as they
+// are. The few crossing a plane are cut down with Sutherland-Hodgman to
+// a polygon, drawn as a fan, with texture coordinates and shading
+// weighted like the positions. So no surface costs more than its part
+// within the band, and the band is small enough for every coordinate in
+// it to fit RASTER_MAX and SPAN_MAX.
+//
+// Depth projects to 1 at the near plane, closer than any normalized
+// model gets and still far enough from 0 to divide by, as the
+// perspective correct planes do.
+
+#define CLIP_NEAR   (DISTANCE / 2.0f)  // from the eye
+#define CLIP_K      ((DISTANCE-1) * fminf(HEIGHT, WIDTH)/2 * SCALE)  // project()'s scale
+#define CLIP_PLANES 5
+#define GUARD       1024  // pixels around the screen
+
+// signed distance of a view space position to a plane, inside if >= 0;
+// the sides are project()'s bounds times the distance from the eye
+static float clip_dist(Vec v, int plane) {
+  float w = v.z + DISTANCE;
+  switch (plane) {
+    case 0: return w - CLIP_NEAR;
+    case 1: return (WIDTH/2 + GUARD) * w + v.x * CLIP_K;
+    case 2: return (WIDTH/2 + GUARD) * w - v.x * CLIP_K;
+    case 3: return (HEIGHT/2 + GUARD) * w + v.y * CLIP_K;
+    default: return (HEIGHT/2 + GUARD) * w - v.y * CLIP_K;
+  }
+}
+
+// one bit for every plane v is outside of, the signs of clip_dist
+static int clip_code(Vec v) {
+  float w = v.z + DISTANCE, x = v.x * CLIP_K, y = v.y * CLIP_K,
+        gx = (WIDTH/2 + GUARD) * w, gy = (HEIGHT/2 + GUARD) * w;
+  return (w - CLIP_NEAR < 0) | (gx + x < 0) << 1 | (gx - x < 0) << 2 |
+         (gy + y < 0) << 3 | (gy - y < 0) << 4;
+}
+
+static Vec clip_lerp(Vec a, Vec b, float t) {
+  Vec tt = {t, t, t};
+  return vec_add(a, vec_mul(vec_sub(b, a), tt));
+}
+
+// cuts the surface with view space vertices v1, v2 and v3 by the planes
+// in code into sf->cut, returns CLIP_CUT or CLIP_OUT if nothing is left
+static int clip_surface(Surface *sf, Vec v1, Vec v2, Vec v3, int code, int snap) {
+  Vec p[CLIP_VERTS] = {v1, v2, v3}, b[CLIP_VERTS] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  int n = 3;
+  for (int plane = 0; plane < CLIP_PLANES && n >= 3; plane++) {
+    if (!(code & (1 << plane))) continue;
+    Vec q[CLIP_VERTS], c[CLIP_VERTS];
+    int m = 0;
+    for (int i = 0, j = n-1; i < n; j = i++) {
+      float di = clip_dist(p[i], plane), dj = clip_dist(p[j], plane);
+      if ((di < 0) != (dj < 0)) {
+        // always from the inside vertex, so that a neighbour sharing the
+        // edge gets exactly the same point
+        int a = di < 0 ? j : i, o = di < 0 ? i : j;
+        float da = di < 0 ? dj : di, t = da / (da - clip_dist(p[o], plane));
+        q[m] = clip_lerp(p[a], p[o], t);
+        c[m++] = clip_lerp(b[a], b[o], t);
+      }
+      if (di >= 0) { q[m] = p[i]; c[m++] = b[i]; }
+    }
+    memcpy(p, q, sizeof(Vec) * m);
+    memcpy(b, c, sizeof(Vec) * m);
+    n = m;
+  }
+  if (n < 3) return CLIP_OUT;
+
+  if (!sf->cut) sf->cut = malloc(sizeof(Clip));
+  for (int i = 0; i < n; i++) {
+    sf->cut->v[i] = project(p[i], snap);
+    sf->cut->b[i] = b[i];
+  }
+  sf->cut->n = n;
+  return CLIP_CUT;
+}
+
+static void raster(Target *t, Surface *sf, State *state, Raster *r) {
+  if (state->raster == RASTER_SPANS)
+    raster_spans(t, sf, state, r);
+  else
+    raster_edges(t, sf, state, r);
+}
+
+void draw_surface(Target *t, Obj *obj, Surface *sf, State *state) {
+  Raster r;
+  if (!raster_setup(obj, sf, state, &r)) return;
+  if (sf->clip != CLIP_CUT) { raster(t, sf, state, &r); return; }
+
+  Clip *c = sf->cut;
+  for (int i = 1; i+1 < c->n; i++) {
+    Surface tri = *sf;
+    Raster tr = r;
+    Vec *v[3] = {&tri.v1, &tri.v2, &tri.v3}, *vt[3] = {&tr.vt1, &tr.vt2, &tr.vt3};
+    int *s[3] = {&tr.s1, &tr.s2, &tr.s3}, k[3] = {0, i, i+1};
+    for (int j = 0; j < 3; j++) {
+      Vec w = c->b[k[j]];
+      Vec a = {w.x*r.vt1.x + w.y*r.vt2.x + w.z*r.vt3.x, w.x*r.vt1.y + w.y*r.vt2.y + w.z*r.vt3.y, 0};
+      *v[j] = c->v[k[j]];
+      *vt[j] = a;
+      *s[j] = lrintf(w.x*r.s1 + w.y*r.s2 + w.z*r.s3);
+    }
+    raster(t, &tri, state, &tr);
+  }
+}
+
+// tiles
+//
+// Visible surfaces are binned into TILE x TILE squares of the screen in
+// the order they are drawn, then the pool rasterizes the tiles, each into
+// a private copy of its depth. A tile only sees its own pixels and keeps
+// the submission order, and the rasterizers never derive a pixel from
+// where their target starts, so this draws exactly what the whole screen
+// at once would.
+
+typedef struct Tiles {
+  list *bin[TILES_X * TILES_Y];  // indices into sfaces
+  int culled_tris[TILES_X * TILES_Y], culled_blocks[TILES_X * TILES_Y];
+} Tiles;
+
+Tiles *tiles_new(void) {
+  Tiles *tiles = malloc(sizeof(Tiles));
+  for (int i = 0; i < TILES_X * TILES_Y; i++) tiles->bin[i] = list_new(sizeof(int));
+  return tiles;
+}
+
+void tiles_del(Tiles *tiles) {
+  for (int i = 0; i < TILES_X * TILES_Y; i++) list_del(tiles->bin[i]);
+  free(tiles);
+}
+
+// tile holding pixel a, clamped before converting as a may be huge
+static int tile_at(float a, int n) {
+  return fminf(fmaxf(a / TILE, 0), n-1);
+}
+
+// the tiles a surface may cover, inclusive
+static void tiles_range(Surface *sf, int *x0, int *y0, int *x1, int *y1) {
+  Vec tri[3] = {sf->v1, sf->v2, sf->v3};
+  Vec *v = sf->clip == CLIP_CUT ? sf->cut->v : tri;
+  int n = sf->clip == CLIP_CUT ? sf->cut->n : 3;
+  float minx = v[0].x, maxx = v[0].x, miny = v[0].y, maxy = v[0].y;
+  for (int i = 1; i < n; i++) {
+    minx = fminf(minx, v[i].x); maxx = fmaxf(maxx, v[i].x);
+    miny = fminf(miny, v[i].y); maxy = fmaxf(maxy, v[i].y);
+  }
+  *x0 = tile_at(floorf(minx), TILES_X);
+  *x1 = tile_at(ceilf(maxx), TILES_X);
+  *y0 = tile_at(floorf(miny), TILES_Y);
+  *y1 = tile_at(ceilf(maxy), TILES_Y);
+}
+
+void tiles_add(Tiles *tiles, Surface *sf, int i) {
+  int x0, y0, x1, y1;
+  tiles_range(sf, &x0, &y0, &x1, &y1);
+  for (int y = y0; y <= y1; y++)
+    for (int x = x0; x <= x1; x++)
+      list_add(tiles->bin[y * TILES_X + x], &i);
+}
+
+typedef struct {
+  Tigr *scr;
+  Obj *obj;
+  State *state;
+  list *sfaces;
+} TileCtx;
+
+static void draw_tile(void *ctx, int job) {
+  TileCtx *c = (TileCtx*)ctx;
+  State *state = c->state;
+  list *bin = state->tiles->bin[job];
+  if (bin->len == 0) return;
+
+  // the tile's depth is drawn in a private copy, straight from the far
+  // plane if it hasn't been cleared this frame
+  Depth *d = state->depth;
+  float depth[TILE * TILE];
+  unsigned short depth16[TILE * TILE + 8];
+  int x0 = (job % TILES_X) * TILE, y0 = (job / TILES_X) * TILE;
+  Target t = {
+    .scr=c->scr, .zpitch=TILE,
+    .hz=&d->hz[y0/HZ * WIDTH/HZ + x0/HZ], .hzpitch=WIDTH/HZ,
+    .x0=x0, .y0=y0, .x1=x0 + TILE < WIDTH ? x0 + TILE : WIDTH, .y1=y0 + TILE < HEIGHT ? y0 + TILE : HEIGHT,
+  };
+  if (state->use_depth16) t.zbuff16 = depth16; else t.zbuff = depth;
+
+  if (state->use_zbuffer && d->tag[job] != d->epoch) {
+    depth_fill(&t, t.x0, t.y0, t.x1, t.y1);
+    d->tag[job] = d->epoch;
+  } else if (state->use_zbuffer) {
+    depth_copy(d, &t, 0);
+  }
+
+  for (int i = 0; i < bin->len; i++) {
+    int idx = *(int*)list_get(bin, i);
+    draw_surface(&t, c->obj, (Surface*)list_get(c->sfaces, idx), state);
+  }
+
+  if (state->use_zbuffer) depth_copy(d, &t, 1);
+  state->tiles->culled_tris[job] = t.culled_tris;
+  state->tiles->culled_blocks[job] = t.culled_blocks;
+}
+
+void draw_stats(Tigr *scr, Stats *stats) {
+  TPixel color = tigrRGB(0xFF, 0xFF, 0x00);
+  float saved = stats->faces*3.0f / (stats->transforms ?: 1);
+  if (stats->pvs)
+    tigrPrint(scr, tfont, 2, 2, color, "faces: %d (%d potentially visible, %d drawn)", stats->faces, stats->pvs, stats->drawn);
+  else
+    tigrPrint(scr, tfont, 2, 2, color, "faces: %d (%d drawn)", stats->faces, stats->drawn);
+  tigrPrint(scr, tfont, 2, 14, color, "transforms: %d (%d uncached, %.1fx less)",
+    stats->transforms, stats->faces*3, saved);
+  if (stats->sort_kept)
+    tigrPrint(scr, tfont, 2, 26, color, "sort: %.2fms (kept order)", stats->sort_ms);
+  else
+    tigrPrint(scr, tfont, 2, 26, color, "sort: %.2fms", stats->sort_ms);
+  if (stats->raster_tiles)
+    tigrPrint(scr, tfont, 2, 38, color, "raster: %.2fms (%d tiles)", stats->raster_ms, stats->raster_tiles);
+  else
+    tigrPrint(scr, tfont, 2, 38, color, "raster: %.2fms", stats->raster_ms);
+  if (stats->hz_tris || stats->hz_blocks)
+    tigrPrint(scr, tfont, 2, 50, color, "coarse z: %d triangles, %d blocks skipped",
+      stats->hz_tris, stats->hz_blocks);
+}
+
+// twice the area a surface covers on the screen, negative if it faces the
+// view; exact when the vertices are snapped, as their products are
+// integers well within a float's precision
+static float surface_area(Surface *sf) {
+  if (sf->clip == CLIP_CUT) {
+    Vec *v = sf->cut->v;
+    float a = 0;
+    for (int i = 0, j = sf->cut->n - 1; i < sf->cut->n; j = i++) a += v[j].x * v[i].y - v[i].x * v[j].y;
+    return a;
+  }
+  return (sf->v2.x - sf->v1.x) * (sf->v3.y - sf->v1.y) - (sf->v3.x - sf->v1.x) * (sf->v2.y - sf->v1.y);
+}
+
+// face bins
+//
+// The camera only orbits the model, so which faces turn away from it is
+// mostly a matter of the view direction. Faces are binned at load by
+// the direction of their normal, one of BIN_DIRS x BIN_DIRS cells on each
+// side of a cube, and by where they are, one of BIN_CELLS^3 cells over
+// the normalized model. Each bin keeps a cone holding its normals and a
+// sphere holding its faces. A bin whose cone points away from the eye
+// for every point of the sphere has no face the per face test would
+// keep. The model's faces are reordered bin by bin, so draw() skips
+// such a bin without looking at its faces.
+//
+// A normal within angle a of axis faces away from p - e, for every p in
+// the sphere around c, where axis.(c - e) - r > (|c - e| + r) sin(a).
+// BIN_MARGIN is added to a so that no face close enough to edge-on for
+// rounding to matter is left to the cone.
+//
+// Jittering snaps vertices down to whole pixels, which changes twice the
+// screen area of a face with edges a and b from its first vertex by less
+// than |a|_1 + |b|_1 + 2, enough to turn small faces around at any angle.
+// A face still can't turn around while twice its area is at least that,
+// which holds when its normal n and every view ray u from the eye have
+//
+//   n.u >= far^3 / near * (sqrt(2) edges far / (K w^2) + 2 area / K^2)
+//
+// with near and far the distances from the eye to the sphere, w the
+// nearest depth in it, K project()'s scale, edges the largest
+// (|a| + |b|) / |a x b| and area the largest 1 / |a x b| of the bin.
+// That cosine is an angle to add to a. The bound holds for faces that
+// aren't clipped, so such bins are only skipped inside the clip planes.
+
+#define BIN_DIRS   8
+#define BIN_CELLS  4
+#define BIN_MARGIN 0.02f  // radians
+
+typedef struct {
+  Vec axis, center;
+  float radius, sin, cos;  // sin above 1 for bins that are never skipped
+  float edges, area;       // of the faces, for jittering, see above
+} Bin;
+
+typedef struct Bins {
+  Bin *bin;
+  int len;
+  int *first;           // each bin's first face, and the number of faces past the last
+  unsigned char *skip;  // per bin, for the current view
+} Bins;
+
+static Vec face_normal(Obj *obj, Face *f) {
+  Vec v1 = vecs_get(obj->v, f->v1-1), v2 = vecs_get(obj->v, f->v2-1), v3 = vecs_get(obj->v, f->v3-1);
+  return vec_cross(vec_sub(v2, v1), vec_sub(v3, v1));
+}
+
+static int bin_cell(float a, int n) {
+  int c = (a + 1) / 2 * n;
+  return c < 0 ? 0 : c >= n ? n-1 : c;
+}
+
+// the cube side of n and its cell there, then the grid cell of p
+static int bin_key(Vec n, Vec p) {
+  float a[3] = {n.x, n.y, n.z}, m[3] = {fabsf(n.x), fabsf(n.y), fabsf(n.z)};
+  int k = m[0] >= m[1] && m[0] >= m[2] ? 0 : m[1] >= m[2] ? 1 : 2;
+  float u = a[(k+1) % 3] / m[k], v = a[(k+2) % 3] / m[k];
+  int dir = ((k*2 + (a[k] < 0)) * BIN_DIRS + bin_cell(u, BIN_DIRS)) * BIN_DIRS + bin_cell(v, BIN_DIRS);
+  int cell = (bin_cell(p.x, BIN_CELLS) * BIN_CELLS + bin_cell(p.y, BIN_CELLS)) * BIN_CELLS + bin_cell(p.z, BIN_CELLS);
+  return dir * BIN_CELLS*BIN_CELLS*BIN_CELLS + cell;
+}
+
+// bins obj's faces, reordering them bin after bin
+Bins *bins_new(Obj *obj) {
+  int nkeys = 6 * BIN_DIRS*BIN_DIRS * BIN_CELLS*BIN_CELLS*BIN_CELLS;
+  int *index = malloc(sizeof(int) * nkeys);
+  for (int i = 0; i < nkeys; i++) index[i] = -1;
+
+  Bins *bins = calloc(1, sizeof(Bins));
+  int *of = malloc(sizeof(int) * obj->f->len);
+  bins->bin = calloc(obj->f->len + 1, sizeof(Bin));
+  Vec *lo = malloc(sizeof(Vec) * (obj->f->len + 1)), *hi = malloc(sizeof(Vec) * (obj->f->len + 1));
+  float *cosmin = malloc(sizeof(float) * (obj->f->len + 1));
+  int degenerate = -1;
+
+  // bins, their axes and bounding boxes
   for (int i = 0; i < obj->f->len; i++) {
-    Surface *sf = (Surface*)list_get(sfaces, i);
-    Face f = *(Face*)list_get(obj->f, sf->idx);
-    sf->v1 = perspective(VREF(list_get(obj->v, f.v1-1)), state.x, state.y, state.z);
-    sf->v2 = perspective(VREF(list_get(obj->v, f.v2-1)), state.x, state.y, state.z);
-    sf->v3 = perspective(VREF(list_get(obj->v, f.v3-1)), state.x, state.y, state.z);
-    sf->nrm = vec_nrm(vec_cross(vec_sub(sf->v2, sf->v1), vec_sub(sf->v3, sf->v1)));
-    sf->v1 = project(sf->v1, state.jitter);
-    sf->v2 = project(sf->v2, state.jitter);
-    sf->v3 = project(sf->v3, state.jitter);
+    Face *f = (Face*)list_get(obj->f, i);
+    Vec n = face_normal(obj, f);
+    int b;
+    if (vec_len(n) == 0) {
+      // no direction to bin by, so never skipped
+      if (degenerate < 0) { degenerate = bins->len++; lo[degenerate].x = FLT_MAX; }
+      b = degenerate;
+    } else {
+      Vec v1 = vecs_get(obj->v, f->v1-1), v2 = vecs_get(obj->v, f->v2-1), v3 = vecs_get(obj->v, f->v3-1);
+      Vec third = {1/3.0f, 1/3.0f, 1/3.0f};
+      int key = bin_key(n, vec_mul(vec_add(vec_add(v1, v2), v3), third));
+      if (index[key] < 0) { index[key] = bins->len++; lo[index[key]].x = FLT_MAX; }
+      b = index[key];
+      bins->bin[b].axis = vec_add(bins->bin[b].axis, vec_nrm(n));
+    }
+    of[i] = b;
+
+    int v[3] = {f->v1, f->v2, f->v3};
+    for (int k = 0; k < 3; k++) {
+      Vec p = vecs_get(obj->v, v[k]-1);
+      if (lo[b].x == FLT_MAX) { lo[b] = hi[b] = p; continue; }
+      lo[b].x = fminf(lo[b].x, p.x); lo[b].y = fminf(lo[b].y, p.y); lo[b].z = fminf(lo[b].z, p.z);
+      hi[b].x = fmaxf(hi[b].x, p.x); hi[b].y = fmaxf(hi[b].y, p.y); hi[b].z = fmaxf(hi[b].z, p.z);
+    }
+  }
+  for (int b = 0; b < bins->len; b++) {
+    Bin *bin = &bins->bin[b];
+    Vec half = {0.5f, 0.5f, 0.5f};
+    bin->center = vec_mul(vec_add(lo[b], hi[b]), half);
+    if (vec_len(bin->axis) > 0) bin->axis = vec_nrm(bin->axis);
+    cosmin[b] = 1;
   }
 
-  if (!state.use_zbuffer) list_sort(sfaces, surface_cmp);
+  // the widest normal, farthest vertex and smallest face of every bin
+  for (int i = 0; i < obj->f->len; i++) {
+    Face *f = (Face*)list_get(obj->f, i);
+    Bin *bin = &bins->bin[of[i]];
+    if (of[i] == degenerate) continue;
+    Vec n = face_normal(obj, f), v1 = vecs_get(obj->v, f->v1-1);
+    float area = vec_len(n);
+    cosmin[of[i]] = fminf(cosmin[of[i]], vec_dot(vec_nrm(n), bin->axis));
+    bin->edges = fmaxf(bin->edges, (vec_len(vec_sub(vecs_get(obj->v, f->v2-1), v1)) +
+                                    vec_len(vec_sub(vecs_get(obj->v, f->v3-1), v1))) / area);
+    bin->area = fmaxf(bin->area, 1 / area);
+    int v[3] = {f->v1, f->v2, f->v3};
+    for (int k = 0; k < 3; k++)
+      bin->radius = fmaxf(bin->radius, vec_len(vec_sub(vecs_get(obj->v, v[k]-1), bin->center)));
+  }
+  for (int b = 0; b < bins->len; b++) {
+    float a = acosf(fminf(fmaxf(cosmin[b], -1), 1)) + BIN_MARGIN;
+    bins->bin[b].sin = b == degenerate || a >= PI/2 ? 2 : sinf(a);
+    bins->bin[b].cos = cosf(a);
+  }
 
-  for (int i = 0; i < sfaces->len; i++) {
-    Surface *sf = (Surface*)list_get(sfaces, i);
+  // the faces bin after bin, in their order within each
+  bins->first = calloc(bins->len + 1, sizeof(int));
+  for (int i = 0; i < obj->f->len; i++) bins->first[of[i] + 1]++;
+  for (int b = 0; b < bins->len; b++) bins->first[b + 1] += bins->first[b];
+  int *at = malloc(sizeof(int) * (bins->len + 1));
+  Face *faces = malloc(sizeof(Face) * (obj->f->len ? obj->f->len : 1));
+  memcpy(at, bins->first, sizeof(int) * (bins->len + 1));
+  for (int i = 0; i < obj->f->len; i++) faces[at[of[i]]++] = *(Face*)list_get(obj->f, i);
+  if (obj->f->len) memcpy(obj->f->p, faces, sizeof(Face) * obj->f->len);
+  free(faces);
+  free(at);
+  free(of);
+
+  bins->bin = realloc(bins->bin, sizeof(Bin) * (bins->len ? bins->len : 1));
+  bins->skip = calloc(bins->len ? bins->len : 1, 1);
+  free(index);
+  free(lo);
+  free(hi);
+  free(cosmin);
+  return bins;
+}
+
+void bins_del(Bins *bins) {
+  free(bins->bin);
+  free(bins->first);
+  free(bins->skip);
+  free(bins);
+}
+
+// follows obj_flip, which turns the model around the x axis
+void bins_flip(Bins *bins) {
+  for (int b = 0; b < bins->len; b++) {
+    Bin *bin = &bins->bin[b];
+    bin->axis.y = -bin->axis.y; bin->axis.z = -bin->axis.z;
+    bin->center.y = -bin->center.y; bin->center.z = -bin->center.z;
+  }
+}
+
+// sin of the bin's cone widened by the angle jittering needs, see above,
+// with its center at c in view space and len from the eye; above 1 if
+// the bin can't be skipped
+static float bin_snapped(Bin *bin, Vec c, float len) {
+  float r = bin->radius, w = c.z + DISTANCE - r, near = len - r, far = len + r;
+  float gx = hypotf(WIDTH/2 + GUARD, CLIP_K), gy = hypotf(HEIGHT/2 + GUARD, CLIP_K);
+  if (clip_dist(c, 0) < r || clip_dist(c, 1) < r * gx || clip_dist(c, 2) < r * gx ||
+      clip_dist(c, 3) < r * gy || clip_dist(c, 4) < r * gy) return 2;
+  float m = far*far*far / near * (sqrtf(2) * bin->edges * far / (CLIP_K * w*w) + 2 * bin->area / (CLIP_K*CLIP_K));
+  if (m >= 1) return 2;
+  // sin(a + asin(m)), unless that is past a right angle
+  float cm = sqrtf(1 - m*m);
+  return bin->cos * cm - bin->sin * m <= 0 ? 2 : bin->sin * cm + bin->cos * m;
+}
+
+// marks the bins facing away from the eye, or towards it with inv, as
+// the backface test in draw would decide for each of their faces, in the
+// view along z, with vertices snapped to pixels or not
+void bins_cull(Bins *bins, Vec x, Vec y, Vec z, int inv, int snap) {
+  Vec eye = {-DISTANCE * z.x, -DISTANCE * z.y, -DISTANCE * z.z};
+  for (int b = 0; b < bins->len; b++) {
+    Bin *bin = &bins->bin[b];
+    Vec d = vec_sub(bin->center, eye);
+    float len = vec_len(d), along = vec_dot(bin->axis, d) * (inv ? -1 : 1);
+    bins->skip[b] = along - bin->radius > (len + bin->radius) * bin->sin;
+    if (bins->skip[b] && snap)
+      bins->skip[b] = along - bin->radius > (len + bin->radius) * bin_snapped(bin, perspective(bin->center, x, y, z), len);
+  }
+}
+
+// potentially visible sets
+//
+// The camera only turns around the model, so what it sees depends on the
+// view direction alone. Directions are split into PVS_YAW x PVS_PITCH
+// cells by the angles main() turns the camera by. The faces seen from the
+// directions at the corners of a cell, and at those of the cells around
+// it for safety, make the cell's set, and draw() only looks at those
+// while the view is in the cell. A direction is sampled by drawing the
+// depth of every opaque face and keeping the faces that come near it
+// anywhere. Both sides are loosened by a pixel, so faces smaller than a
+// pixel and the shifts of snapped vertices are still caught, which on
+// models made of such faces keeps almost everything. Faces with any
+// transparent texels hide nothing, so the sets hold for the painter's
+// order as well.
+//
+// Sets are made the first time the view enters their cell, sampling the
+// directions no cell made so far needed, which stalls a large model for
+// a moment.
+
+#define PVS_YAW   24
+#define PVS_PITCH 12
+#define PVS_SAMPLES (PVS_YAW * (PVS_PITCH+1))
+
+typedef unsigned long long Bits;
+
+typedef struct Pvs {
+  Bits *sample[PVS_SAMPLES];  // faces seen from every corner direction
+  Bits *cell[PVS_YAW * PVS_PITCH];
+  int words;
+  Clip cut;
+  float depth[WIDTH * HEIGHT];
+} Pvs;
+
+Pvs *pvs_new(int faces) {
+  Pvs *pvs = calloc(1, sizeof(Pvs));
+  pvs->words = (faces + 63) / 64;
+  return pvs;
+}
+
+// forgets every set, after the model changed
+void pvs_reset(Pvs *pvs) {
+  for (int i = 0; i < PVS_SAMPLES; i++) { free(pvs->sample[i]); pvs->sample[i] = NULL; }
+  for (int i = 0; i < PVS_YAW * PVS_PITCH; i++) { free(pvs->cell[i]); pvs->cell[i] = NULL; }
+}
+
+void pvs_del(Pvs *pvs) {
+  pvs_reset(pvs);
+  free(pvs);
+}
+
+static void pvs_mark(Bits *bits, int i) {
+  bits[i >> 6] |= 1ull << (i & 63);
+}
+
+// draws a triangle's depth over the pixels raster_edges would cover, or
+// with seen set, marks it seen if it reaches the depth anywhere within a
+// pixel of its edges, so faces smaller than a pixel aren't lost between
+// pixel centers
+static void pvs_triangle(Pvs *pvs, Vec v1, Vec v2, Vec v3, int id, Bits *seen) {
+  int grow = seen != NULL;
+  int minX = fmaxf(floorf(fminf(fminf(v1.x, v2.x), v3.x)) - grow, 0),
+      maxX = fminf(fmaxf(fmaxf(v1.x, v2.x), v3.x)+1 + grow, WIDTH),
+      minY = fmaxf(floorf(fminf(fminf(v1.y, v2.y), v3.y)) - grow, 0),
+      maxY = fminf(fmaxf(fmaxf(v1.y, v2.y), v3.y)+1 + grow, HEIGHT);
+  if (minX >= maxX || minY >= maxY) return;
+
+  Edge e[3];
+  long long d = edges(v1, v2, v3, minX, minY, e);
+  if (d == 0) return;
+  Plane pz = plane(e, 1.0 / d, v1.z, v2.z, v3.z);
+  float nearest = fminf(fminf(v1.z, v2.z), v3.z), slack = fabs(pz.dx) + fabs(pz.dy);
+  if (seen) {
+    for (int i = 0; i < 3; i++) e[i].e += llabs(e[i].dx) + llabs(e[i].dy);
+  } else {
+    edges_topleft(e);
+  }
+
+  for (int y = minY; y < maxY; y++) {
+    int dy = y - minY, x0 = 0, x1 = maxX - minX;
+    long long ev[3] = {e[0].e + e[0].dy*dy, e[1].e + e[1].dy*dy, e[2].e + e[2].dy*dy};
+    edges_span(e, ev, &x0, &x1);
+    for (int x = x0; x < x1; x++) {
+      int p = y * WIDTH + minX + x;
+      float z = pz.a + pz.dx*x + pz.dy*dy;
+      if (seen) {
+        if (fmaxf(z - slack, nearest) <= pvs->depth[p]) { pvs_mark(seen, id); return; }
+      } else if (z + slack < pvs->depth[p]) {
+        pvs->depth[p] = z + slack;
+      }
+    }
+  }
+}
+
+// whether a surface faces the view, or might once its vertices were
+// snapped: moving them by up to a pixel changes twice the area by at most
+// the sum of the edges' lengths along both axes, plus a bit
+static int pvs_facing(Surface *sf) {
+  Vec *v = sf->clip == CLIP_CUT ? sf->cut->v : (Vec[]){sf->v1, sf->v2, sf->v3};
+  int n = sf->clip == CLIP_CUT ? sf->cut->n : 3;
+  float slack = 2;
+  for (int i = 0, j = n-1; i < n; j = i++) slack += fabsf(v[i].x - v[j].x) + fabsf(v[i].y - v[j].y);
+  return surface_area(sf) < slack;
+}
+
+// the faces seen from the direction main() turns the camera to with
+// rotX and rotY, using state's vertex streams: the opaque faces draw the
+// depth first, then every face is tested against it
+static Bits *pvs_sample(Pvs *pvs, Obj *obj, State *state, float rotX, float rotY) {
+  Vec upward = {0, 1, 0};
+  Vec z = {cos(rotX)*sin(rotY), -sin(rotX), cos(rotX)*cos(rotY)};
+  Vec x = vec_nrm(vec_cross(upward, z));
+  Vec y = vec_cross(z, x);
+  transform(obj->v, state->view, state->proj, x, y, z, 0);
+
+  Bits *seen = calloc(pvs->words, sizeof(Bits));
+  for (int i = 0; i < WIDTH * HEIGHT; i++) pvs->depth[i] = FLT_MAX;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < obj->f->len; i++) {
+      Face *f = (Face*)list_get(obj->f, i);
+      Texture *texture = f->mtl >= 0 ? ((Mtl*)list_get(obj->mtl, f->mtl))->texture : NULL;
+      if (texture == NULL || (pass == 0 && !texture->opaque)) continue;
+
+      Surface sf = {.v1=vecs_get(state->proj, f->v1-1), .v2=vecs_get(state->proj, f->v2-1),
+                    .v3=vecs_get(state->proj, f->v3-1), .cut=&pvs->cut};
+      Vec v1 = vecs_get(state->view, f->v1-1), v2 = vecs_get(state->view, f->v2-1), v3 = vecs_get(state->view, f->v3-1);
+      int c1 = clip_code(v1), c2 = clip_code(v2), c3 = clip_code(v3);
+      if (c1 & c2 & c3) continue;
+      if (c1 | c2 | c3) sf.clip = clip_surface(&sf, v1, v2, v3, c1 | c2 | c3, 0);
+      if (sf.clip == CLIP_OUT || (pass == 0 ? surface_area(&sf) >= 0 : !pvs_facing(&sf))) continue;
+
+      Bits *mark = pass ? seen : NULL;
+      if (sf.clip == CLIP_CUT) {
+        for (int k = 1; k+1 < pvs->cut.n; k++)
+          pvs_triangle(pvs, pvs->cut.v[0], pvs->cut.v[k], pvs->cut.v[k+1], i, mark);
+      } else {
+        pvs_triangle(pvs, sf.v1, sf.v2, sf.v3, i, mark);
+      }
+    }
+  }
+  return seen;
+}
+
+// the cell view direction z is in, from the angles main() turns the
+// camera by; the inverse of the z main() makes of them
+static void pvs_cell(Vec z, int *cx, int *cy) {
+  float yaw = atan2f(z.x, z.z), pitch = asinf(fminf(fmaxf(-z.y, -1), 1));
+  *cx = (int)floorf(yaw / (2*PI) * PVS_YAW + PVS_YAW) % PVS_YAW;
+  *cy = (pitch + PI/2) / PI * PVS_PITCH;
+  *cy = *cy < 0 ? 0 : *cy >= PVS_PITCH ? PVS_PITCH-1 : *cy;
+}
+
+// the set for view direction z, made if the view hasn't been there yet;
+// overwrites state's vertex streams when it has to sample
+Bits *pvs_get(Pvs *pvs, Obj *obj, State *state, Vec z) {
+  int cx, cy;
+  pvs_cell(z, &cx, &cy);
+  Bits **cell = &pvs->cell[cy * PVS_YAW + cx];
+  if (*cell) return *cell;
+  *cell = calloc(pvs->words, sizeof(Bits));
+  for (int j = cy-1; j <= cy+2; j++) {
+    if (j < 0 || j > PVS_PITCH) continue;
+    for (int i = cx-1; i <= cx+2; i++) {
+      int k = j * PVS_YAW + (i + PVS_YAW) % PVS_YAW;
+      if (!pvs->sample[k]) {
+        float rotX = fminf(fmaxf(-PI/2 + PI * j / PVS_PITCH, -PI/2), PI/2);
+        pvs->sample[k] = pvs_sample(pvs, obj, state, rotX, 2*PI * i / PVS_YAW);
+      }
+      for (int w = 0; w < pvs->words; w++) (*cell)[w] |= pvs->sample[k][w];
+    }
+  }
+  return *cell;
+}
+
+// painter's orders per view direction
+//
+// For the same reason as the potentially visible sets, painter's orders
+// can be kept per cell of the same grid. The first time the view enters
+// a cell, all faces are sorted exactly by their depth from its center.
+// Every frame in the cell then only picks the drawn faces out of that
+// order, see ot_from, which needs neither keys nor buckets. Faces whose
+// order flips within the cell are drawn a little out of order, the way
+// the ordering table's buckets mix up close faces too.
+//
+// An order takes an int per face. At most ORDERS_MEMORY bytes of them
+// are kept, which holds every cell for small models; past that, entering
+// a new cell drops the order of the one the view was in longest ago.
+
+#define ORDERS_MEMORY (64 << 20)
+
+typedef struct {
+  float key;
+  int i;
+} OrderKey;
+
+typedef struct Orders {
+  int *order[PVS_YAW * PVS_PITCH];  // faces far to near from each cell's center
+  unsigned used[PVS_YAW * PVS_PITCH];  // when each order was last taken
+  unsigned clock;
+  int kept, most;                   // orders kept, and how many fit ORDERS_MEMORY
+  int maxz;                         // what the orders were sorted by
+  OrderKey *keys;                   // scratch for sorting
+} Orders;
+
+Orders *orders_new(int faces) {
+  Orders *o = calloc(1, sizeof(Orders));
+  o->keys = malloc(sizeof(OrderKey) * faces);
+  o->most = ORDERS_MEMORY / (sizeof(int) * (faces ? faces : 1));
+  o->most = o->most < 1 ? 1 : o->most > PVS_YAW * PVS_PITCH ? PVS_YAW * PVS_PITCH : o->most;
+  return o;
+}
+
+// forgets every order, after the model changed
+void orders_reset(Orders *o) {
+  for (int i = 0; i < PVS_YAW * PVS_PITCH; i++) { free(o->order[i]); o->order[i] = NULL; }
+  o->kept = 0;
+}
+
+void orders_del(Orders *o) {
+  orders_reset(o);
+  free(o->keys);
+  free(o);
+}
+
+// farthest first, ties by index so the order doesn't depend on qsort
+static int orders_cmp(const void *a, const void *b) {
+  const OrderKey *ka = a, *kb = b;
+  if (ka->key != kb->key) return ka->key < kb->key ? 1 : -1;
+  return ka->i - kb->i;
+}
+
+// the order of all faces for view direction dir, by the same keys as
+// ot_keys, made if the view hasn't been there yet; overwrites state's
+// vertex streams when it has to
+int *orders_get(Orders *o, Obj *obj, State *state, Vec dir) {
+  int cx, cy;
+  pvs_cell(dir, &cx, &cy);
+  if (o->maxz != state->sort_maxz) { orders_reset(o); o->maxz = state->sort_maxz; }
+
+  int c = cy * PVS_YAW + cx;
+  o->used[c] = ++o->clock;
+  if (o->order[c]) return o->order[c];
+  int *order = NULL;
+  if (o->kept == o->most) {
+    // the least recently used order makes room, and lends its memory
+    int old = -1;
+    for (int i = 0; i < PVS_YAW * PVS_PITCH; i++)
+      if (o->order[i] && (old < 0 || o->used[i] < o->used[old])) old = i;
+    order = o->order[old];
+    o->order[old] = NULL;
+    o->kept--;
+  }
+
+  float rotX = -PI/2 + PI * (cy + 0.5f) / PVS_PITCH, rotY = 2*PI * (cx + 0.5f) / PVS_YAW;
+  Vec upward = {0, 1, 0};
+  Vec z = {cos(rotX)*sin(rotY), -sin(rotX), cos(rotX)*cos(rotY)};
+  Vec x = vec_nrm(vec_cross(upward, z));
+  Vec y = vec_cross(z, x);
+  transform(obj->v, state->view, state->proj, x, y, z, 0);
+
+  for (int i = 0; i < obj->f->len; i++) {
+    Face *f = (Face*)list_get(obj->f, i);
+    Vec v1 = vecs_get(state->proj, f->v1-1), v2 = vecs_get(state->proj, f->v2-1), v3 = vecs_get(state->proj, f->v3-1);
+    o->keys[i].key = o->maxz ? fmaxf(fmaxf(v1.z, v2.z), v3.z) : (v1.z + v2.z + v3.z) / 3;
+    o->keys[i].i = i;
+  }
+  qsort(o->keys, obj->f->len, sizeof(OrderKey), orders_cmp);
+  o->order[c] = order ? order : malloc(sizeof(int) * obj->f->len);
+  o->kept++;
+  for (int i = 0; i < obj->f->len; i++) o->order[c][i] = o->keys[i].i;
+  return o->order[c];
+}
+
+void draw(Tigr *scr, Obj *obj, State state, list *sfaces) {
+  Bits *pvs = NULL;
+  if (state.use_pvs && !state.draw_wireframe && !state.inv_bculling)
+    pvs = pvs_get(state.pvs, obj, &state, state.z);
+  int *order = NULL;
+  if (state.sort_cached && !state.use_zbuffer && !state.draw_wireframe)
+    order = orders_get(state.orders, obj, &state, state.z);
+
+  // every vertex is transformed once and shared by all faces using it
+  transform(obj->v, state.view, state.proj, state.x, state.y, state.z, state.jitter);
+  state.stats->faces = obj->f->len;
+  state.stats->transforms = obj->v->len;
+  if (state.shading == SHADING_GOURAUD && !state.draw_wireframe)
+    shade_normals(obj->vn, state.shades, state.x, state.y, state.z);
+  for (int i = 0; i < obj->mtl->len; i++) {
+    Texture *tex = ((Mtl*)list_get(obj->mtl, i))->texture;
+    if (state.shading != SHADING_NONE && state.use_shadelut) tex_lit(tex);
+    tex_blocks(tex, state.use_texblocks);
+  }
+
+  // surfaces left after clipping and culling are listed in state.drawn,
+  // everything past this loop only sees those
+  int n = 0, bins = state.use_bins && !state.draw_wireframe;
+  if (bins) bins_cull(state.bins, state.x, state.y, state.z, state.inv_bculling, state.jitter);
+  state.stats->pvs = 0;
+  for (int w = 0; pvs && w < state.pvs->words; w++) state.stats->pvs += __builtin_popcountll(pvs[w]);
+  for (int b = 0; b < state.bins->len; b++) {
+    if (bins && state.bins->skip[b]) continue;
+    for (int i = state.bins->first[b]; i < state.bins->first[b+1]; i++) {
+      if (pvs && !(pvs[i >> 6] >> (i & 63) & 1)) continue;
+      Surface *sf = (Surface*)list_get(sfaces, i);
+      Face f = *(Face*)list_get(obj->f, sf->idx);
+      Vec v1 = vecs_get(state.view, f.v1-1),
+          v2 = vecs_get(state.view, f.v2-1),
+          v3 = vecs_get(state.view, f.v3-1);
+      sf->v1 = vecs_get(state.proj, f.v1-1);
+      sf->v2 = vecs_get(state.proj, f.v2-1);
+      sf->v3 = vecs_get(state.proj, f.v3-1);
+
+      int c1 = clip_code(v1), c2 = clip_code(v2), c3 = clip_code(v3);
+      if (c1 & c2 & c3) continue;
+      sf->clip = CLIP_IN;
+      if (c1 | c2 | c3) sf->clip = clip_surface(sf, v1, v2, v3, c1 | c2 | c3, state.jitter);
+      if (sf->clip == CLIP_OUT) continue;
+
+      if (!state.draw_wireframe) {
+        float inv = state.inv_bculling ? -1 : 1;
+        if (surface_area(sf) * inv >= 0) continue;
+        if (state.shading == SHADING_FLAT)
+          sf->nrm = vec_nrm(vec_cross(vec_sub(v2, v1), vec_sub(v3, v1)));
+      }
+      state.drawn[n++] = i;
+    }
+  }
+  state.stats->drawn = n;
+
+  double t = now();
+  state.stats->sort_kept = order != NULL;
+  if (order)
+    ot_from(state.ot, state.drawn, n, order, obj->f->len);
+  else if (!state.use_zbuffer)
+    ot_sort(state.ot, sfaces, state.drawn, n, state.sort_maxz);
+  state.stats->sort_ms = (now() - t) * 1000;
+
+  t = now();
+  state.stats->raster_tiles = 0;
+  if (state.use_tiles && !state.draw_wireframe) {
+    for (int i = 0; i < TILES_X * TILES_Y; i++) state.tiles->bin[i]->len = 0;
+  }
+  Target screen = {
+    .scr=scr, .zpitch=WIDTH, .hz=state.depth->hz, .hzpitch=WIDTH/HZ,
+    .x0=0, .y0=0, .x1=WIDTH, .y1=HEIGHT,
+  };
+  if (state.use_depth16) screen.zbuff16 = state.depth->u16; else screen.zbuff = state.depth->f32;
+
+  for (int i = 0; i < n; i++) {
+    int idx = state.use_zbuffer ? state.drawn[i] : state.ot->order[i];
+    Surface *sf = (Surface*)list_get(sfaces, idx);
     if (state.draw_wireframe) {
       draw_wireframe(scr, *sf, tigrRGB(0xFF, 0xFF, 0xFF));
     } else {
-      Vec forward = {0, 0, -1};
-      float inv = state.inv_bculling ? -1 : 1;
-      if (vec_dot(sf->nrm, forward) * inv > 0) draw_surface(scr, obj, *sf, state);
+      if (state.use_tiles) {
+        tiles_add(state.tiles, sf, idx);
+        continue;
+      }
+      if (state.use_zbuffer) {
+        int x0, y0, x1, y1;
+        tiles_range(sf, &x0, &y0, &x1, &y1);
+        for (int y = y0; y <= y1; y++)
+          for (int x = x0; x <= x1; x++) depth_touch(state.depth, &screen, y * TILES_X + x);
+      }
+      draw_surface(&screen, obj, sf, &state);
+    }
+  }
+
+  if (state.use_tiles && !state.draw_wireframe) {
+    TileCtx ctx = {scr, obj, &state, sfaces};
+    pool_run(state.pool, TILES_X * TILES_Y, draw_tile, &ctx);
+    for (int i = 0; i < TILES_X * TILES_Y; i++) {
+      if (state.tiles->bin[i]->len == 0) continue;
+      state.stats->raster_tiles++;
+      screen.culled_tris += state.tiles->culled_tris[i];
+      screen.culled_blocks += state.tiles->culled_blocks[i];
     }
   }
+  state.stats->raster_ms = (now() - t) * 1000;
+  state.stats->hz_tris = screen.culled_tris;
+  state.stats->hz_blocks = screen.culled_blocks;
+}
+
+// --bench: raster time of a turntable of frames drawn offscreen, for
+// every combination of the flags the scalar pixel loop is specialized
+// for, with the generic loop and with the variant. The fastest of a few
+// turns is kept, as the slower ones mostly measure everything else
+// running on the machine.
+
+#define BENCH_FRAMES 60
+#define BENCH_TURNS  5
+
+static double bench_run(Tigr *scr, Obj *obj, State state, list *sfaces) {
+  Vec upward = {0, 1, 0};
+  double ms = 0, best = 0;
+  for (int i = 0; i < BENCH_FRAMES * BENCH_TURNS; i++) {
+    float rotX = 0.3, rotY = 2*PI * i / BENCH_FRAMES;
+    Vec z = {cos(rotX)*sin(rotY), -sin(rotX), cos(rotX)*cos(rotY)};
+    Vec x = vec_nrm(vec_cross(upward, z));
+    Vec y = vec_cross(z, x);
+    depth_clear(state.depth);
+    state.x = x; state.y = y; state.z = z;
+    tigrClear(scr, tigrRGB(0, 0, 0));
+    draw(scr, obj, state, sfaces);
+    ms += state.stats->raster_ms;
+    if ((i + 1) % BENCH_FRAMES == 0) {
+      if (best == 0 || ms < best) best = ms;
+      ms = 0;
+    }
+  }
+  return best / BENCH_FRAMES;
+}
+
+void bench(Tigr *scr, Obj *obj, State state, list *sfaces) {
+  const char *pcorrect[] = {"affine", "exact", "stepped"}, *lighting[] = {"unlit", "flat", "gouraud"};
+  state.draw_wireframe = 0;
+  state.use_simd = 0;
+  state.use_tiles = 0;
+  printf("zbuffer perspective shading  generic  variant\n");
+  for (int z = 0; z < 2; z++)
+    for (int p = SPAN_AFFINE; p <= SPAN_STEPPED; p++)
+      for (int l = SPAN_UNLIT; l <= SPAN_GOURAUD; l++) {
+        state.use_zbuffer = z;
+        state.use_pcorrect = p != SPAN_AFFINE;
+        state.pcorrect_step = p == SPAN_STEPPED ? 16 : 1;
+        state.shading = l == SPAN_GOURAUD ? SHADING_GOURAUD : l == SPAN_FLAT ? SHADING_FLAT : SHADING_NONE;
+        state.use_variants = 0;
+        double generic = bench_run(scr, obj, state, sfaces);
+        state.use_variants = 1;
+        double variant = bench_run(scr, obj, state, sfaces);
+        printf("%-7s %-11s %-8s %6.2fms %6.2fms %5.2fx\n", z ? "on" : "off", pcorrect[p], lighting[l],
+          generic, variant, generic / variant);
+      }
 }
 
 int main(int argc, char **argv) {
-  if (argc != 2) error("usage: %s path/to/obj", argv[0]);
+  int benchmark = argc == 3 && strcmp(argv[1], "--bench") == 0;
+  if (argc != 2 && !benchmark) error("usage: %s [--bench] path/to/obj", argv[0]);
 
-  char *filepath = argv[1];
-  Obj *obj = obj_readfile(filepath);
-  obj_normalize(obj);
+  char *filepath = argv[argc - 1];
+  pool *pool = pool_new(cpu_count());
+  Obj *obj = obj_load(filepath, pool);
 
   list *sfaces = list_new(sizeof(Surface));
   for (int i = 0; i < obj->f->len; i++) {
-    Surface sf;
-    sf.idx = i;
+    Surface sf = {.idx=i};
     list_add(sfaces, &sf);
   }
 
   printf("%d vertices, %d faces\n", obj->v->len, obj->f->len);
 
-  Tigr *screen = tigrWindow(WIDTH, HEIGHT, "tipsy", TIGR_FIXED | TIGR_RETINA);
-  TPixel colorBlack = tigrRGB(0, 0, 0);
-
   State state = {
-    .draw_wireframe=(obj->mtl == NULL),
+    .draw_wireframe=(obj->mtl->len == 0),
     .use_zbuffer=0, .use_pcorrect=0,
-    .inv_bculling=0, .jitter=1,
+    .inv_bculling=0, .jitter=1, .use_tiles=(pool->nthreads > 1), .use_simd=1, .use_hz=1,
+    .pcorrect_step=1, .use_variants=1, .use_bins=1,
   };
-  state.zbuff = malloc(sizeof(float) * (WIDTH * HEIGHT));
+  state.depth = depth_new();
+  state.view = vecs_new(obj->v->len);
+  state.proj = vecs_new(obj->v->len);
+  state.shades = malloc(sizeof(int) * obj->vn->len);
+  state.drawn = malloc(sizeof(int) * obj->f->len);
+  state.bins = bins_new(obj);
+  state.pvs = pvs_new(obj->f->len);
+  state.orders = orders_new(obj->f->len);
+  state.ot = ot_new(obj->f->len);
+  state.tiles = tiles_new();
+  state.pool = pool;
+  Stats stats = {0};
+  state.stats = &stats;
+
+  Tigr *screen = benchmark ? tigrBitmap(WIDTH, HEIGHT) : tigrWindow(WIDTH, HEIGHT, "tipsy", TIGR_FIXED | TIGR_RETINA);
+  TPixel colorBlack = tigrRGB(0, 0, 0);
+  if (benchmark) bench(screen, obj, state, sfaces);
 
   Vec upward = {0, 1, 0};
   float rotX = 0, rotY = 0, sensitivity = 0.05;
@@ -548,7 +3368,7 @@ int main(int argc, char **argv) {
   float elapsed = 1;
   int input = 1;
 
-  while (!tigrClosed(screen) && !tigrKeyDown(screen, TK_ESCAPE)) {
+  while (!benchmark && !tigrClosed(screen) && !tigrKeyDown(screen, TK_ESCAPE)) {
     // FPS cap
     elapsed += tigrTime();
     if (elapsed < 1.0/FPS) { continue; } else { elapsed = 0; }
@@ -560,9 +3380,22 @@ int main(int argc, char **argv) {
     if (tigrKeyDown(screen, 'W') && (input = 1)) state.draw_wireframe ^= 1;
     if (tigrKeyDown(screen, 'Z') && (input = 1)) state.use_zbuffer ^= 1;
     if (tigrKeyDown(screen, 'P') && (input = 1)) state.use_pcorrect ^= 1;
+    if (tigrKeyDown(screen, 'N') && (input = 1)) state.pcorrect_step = state.pcorrect_step < 32 ? state.pcorrect_step * 2 : 1;
     if (tigrKeyDown(screen, 'C') && (input = 1)) state.inv_bculling ^= 1;
+    if (tigrKeyDown(screen, 'G') && (input = 1)) state.use_bins ^= 1;
+    if (tigrKeyDown(screen, 'U') && (input = 1)) state.use_pvs ^= 1;
     if (tigrKeyDown(screen, 'J') && (input = 1)) state.jitter ^= 1;
-    if (tigrKeyDown(screen, 'F') && (input = 1)) obj_flip(obj);
+    if (tigrKeyDown(screen, 'F') && (input = 1)) { obj_flip(obj); bins_flip(state.bins); pvs_reset(state.pvs); orders_reset(state.orders); }
+    if (tigrKeyDown(screen, 'S') && (input = 1)) state.show_stats ^= 1;
+    if (tigrKeyDown(screen, 'O') && (input = 1)) state.sort_maxz ^= 1;
+    if (tigrKeyDown(screen, 'K') && (input = 1)) state.sort_cached ^= 1;
+    if (tigrKeyDown(screen, 'E') && (input = 1)) state.raster ^= RASTER_SPANS;
+    if (tigrKeyDown(screen, 'M') && (input = 1)) state.use_tiles ^= 1;
+    if (tigrKeyDown(screen, 'V') && (input = 1)) state.use_simd ^= 1;
+    if (tigrKeyDown(screen, 'H') && (input = 1)) state.use_hz ^= 1;
+    if (tigrKeyDown(screen, 'D') && (input = 1)) state.use_depth16 ^= 1;
+    if (tigrKeyDown(screen, 'B') && (input = 1)) state.use_texblocks ^= 1;
+    if (tigrKeyDown(screen, 'L') && (input = 1)) state.use_shadelut ^= 1;
     if (tigrKeyDown(screen, 'R') && (input = 1)) rotX = rotY = 0;
     if (tigrKeyDown(screen, '1') && (input = 1)) state.shading = SHADING_NONE;
     if (tigrKeyDown(screen, '2') && (input = 1)) state.shading = SHADING_FLAT;
@@ -590,18 +3423,29 @@ int main(int argc, char **argv) {
     Vec x = vec_nrm(vec_cross(upward, z));
     Vec y = vec_cross(z, x);
 
-    if (state.use_zbuffer)
-      for (int i = 0; i < WIDTH*HEIGHT; state.zbuff[i++] = FLT_MAX);
+    depth_clear(state.depth);
 
     state.x = x; state.y = y; state.z = z;
     tigrClear(screen, colorBlack);
     draw(screen, obj, state, sfaces);
+    if (state.show_stats) draw_stats(screen, &stats);
     tigrUpdate(screen);
   }
 
   tigrFree(screen);
   obj_del(obj);
+  for (int i = 0; i < sfaces->len; i++) free(((Surface*)list_get(sfaces, i))->cut);
   list_del(sfaces);
-  free(state.zbuff);
+  pool_del(pool);
+  depth_del(state.depth);
+  vecs_del(state.view);
+  vecs_del(state.proj);
+  free(state.shades);
+  free(state.drawn);
+  bins_del(state.bins);
+  pvs_del(state.pvs);
+  orders_del(state.orders);
+  ot_del(state.ot);
+  tiles_del(state.tiles);
   return 0;
 }